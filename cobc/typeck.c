@@ -12384,8 +12384,13 @@ cb_emit_sort_using (cb_tree file, cb_tree l)
 			cb_error_x (CB_TREE (current_statement),
 				    _("invalid SORT USING parameter"));
 		}
-		cb_emit (CB_BUILD_FUNCALL_2 ("cob_file_sort_using",
-			rtree, cb_ref (CB_VALUE (l))));
+		if (current_statement->flag_merge) {
+			cb_emit (CB_BUILD_FUNCALL_2 ("cob_file_merge_using",
+				rtree, cb_ref (CB_VALUE (l))));
+		} else {
+			cb_emit (CB_BUILD_FUNCALL_2 ("cob_file_sort_using",
+				rtree, cb_ref (CB_VALUE (l))));
+		}
 	}
 }
 
@@ -256,13 +256,30 @@ typedef struct __cob_settings {
 	unsigned int	cob_stop_run_commit;/* On STOP RUN, should it COMMIT, Default is ROLLBACK */
 	unsigned int	cob_concat_name;	/* Concatenated sequential input file names */
 	unsigned char	cob_concat_sep[4];	/* Concatenated sequential file name separater (+)*/
+	unsigned int	cob_file_mmap;		/* Map SEQUENTIAL/RELATIVE files opened INPUT */
+	unsigned int	cob_rel_slotmap;	/* Keep map of used slots for RELATIVE files */
+	unsigned int	cob_file_compress;	/* Compression of SEQUENTIAL/LINE SEQUENTIAL files */
+	unsigned int	cob_sort_threads;	/* Threads used to sort in memory */
+	unsigned int	cob_sort_direct;	/* O_DIRECT for SORT work files */
+	unsigned int	cob_sort_compress;	/* Compression of SORT work files */
+	unsigned int	cob_merge_check;	/* Check order of MERGE input */
+	char		*cob_tmpdir;		/* List of temporary directories */
+	char		*cob_sort_stats;	/* Place to write SORT stats */
 	char		*cob_dictionary_path;	/* Place to write filename.dd stats */
 	char		*cob_stats_filename;	/* Place to write I/O stats */
 	char 		*cob_file_path;
 	char		*bdb_home;
 	char		*lmdb_home;
+	unsigned int	cob_lmdb_commit;	/* LMDB updates per commit */
+	unsigned int	cob_lmdb_commit_time;	/* LMDB milliseconds per commit */
 	size_t		cob_sort_memory;
 	size_t		cob_sort_chunk;
+	size_t		cob_seq_buffer;		/* Read-ahead buffer size for SEQUENTIAL files */
+	size_t		cob_write_buffer;	/* Write-behind buffer size for SEQUENTIAL/RELATIVE files */
+	size_t		cob_seq_prefetch;	/* Prefetch distance for SEQUENTIAL/LINE SEQUENTIAL input */
+	size_t		cob_lmdb_mapsize;	/* Initial size of LMDB maps */
+	size_t		cob_lmdb_maxsize;	/* Maximum size of LMDB maps */
+	size_t		cob_bdb_bulk_read;	/* Bulk buffer of BDB READ NEXT */
 
 	/* move.c */
 	unsigned int	cob_local_edit;
@@ -411,6 +428,11 @@ COB_HIDDEN void		cob_exit_strings	(void);
 COB_HIDDEN void		cob_exit_mlio		(void);
 
 COB_HIDDEN FILE		*cob_create_tmpfile	(const char *);
+COB_HIDDEN void		cob_sort_table		(cob_field *, const size_t,
+						 cob_file_key *, const int,
+						 const unsigned char *);
+COB_HIDDEN unsigned int	cob_temp_dir_count	(void);
+COB_HIDDEN void		cob_temp_name_dir	(char *, const unsigned int);
 COB_HIDDEN int		cob_check_numval_f	(const cob_field *);
 
 COB_HIDDEN int		cob_real_get_sign	(cob_field *);
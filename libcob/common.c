@@ -208,6 +208,10 @@ static const cob_field_attr	const_bin_nano_attr =
 				 COB_FLAG_HAVE_SIGN, NULL};
 
 static char			*cob_local_env = NULL;
+static char			*cob_tmpdir_buff = NULL;	/* Copy of the list */
+static char			**cob_tmpdirs = NULL;		/* Entries of it */
+static unsigned int		cob_tmpdir_count = 0;
+static unsigned int		cob_tmpdirs_done = 0;
 static int			current_arg = 0;
 static unsigned char		*commlnptr = NULL;
 static size_t			commlncnt = 0;
@@ -215,9 +219,14 @@ static size_t			cob_local_env_size = 0;
 
 static struct cob_external	*basext = NULL;
 
-static size_t			sort_nkeys = 0;
-static cob_file_key		*sort_keys = NULL;
-static const unsigned char	*sort_collate = NULL;
+/* Keys of a table SORT, from cob_table_sort_init to cob_table_sort */
+struct cob_table_sort {
+	struct cob_table_sort	*next;
+	cob_file_key		*keys;
+	const unsigned char	*collate;
+	int			nkeys;
+};
+static struct cob_table_sort	*table_sort = NULL;
 
 static const char		*cob_source_file = NULL;
 static unsigned int		cob_source_line = 0;
@@ -427,6 +436,8 @@ static char	varseq_dflt[8] = "0";	/* varseq0: Default Variable length Sequential
 #endif
 static struct config_enum shareopts[]	= {{"none","0"},{"read","1"},{"all","2"},{"no","4"},{NULL,NULL}};
 static struct config_enum retryopts[]	= {{"none","0"},{"never","64"},{"forever","8"},{NULL,NULL}};
+static struct config_enum compressopts[]	= {{"none","0"},{"gzip","1"},{"zstd","2"},{"auto","3"},{NULL,NULL}};
+static struct config_enum sortmemopts[]	= {{"auto","0"},{NULL,NULL}};
 static struct config_enum dict_opts[]	= {{"false","0"},{"true","1"},{"always","2"},
 											{"no","0"},{"min","1"},{"max","2"},{NULL,NULL}};
 static struct config_enum dups_opts[]	= {{"default","0"},{"never","1"},{"always","2"}};
@@ -510,7 +521,13 @@ static struct config_tbl gc_conf[] = {
 	{"COB_RETRY_TIMES","retry_times",		"0",NULL,GRP_FILE,ENV_UINT,SETPOS(cob_retry_times)},
 	{"COB_RETRY_SECONDS","retry_seconds",	"0",NULL,GRP_FILE,ENV_UINT,SETPOS(cob_retry_seconds)},
 	{"COB_SORT_CHUNK","sort_chunk",		"256K",	NULL,GRP_FILE,ENV_SIZE,SETPOS(cob_sort_chunk),(128 * 1024),(16 * 1024 * 1024)},
-	{"COB_SORT_MEMORY","sort_memory",	"128M",	NULL,GRP_FILE,ENV_SIZE,SETPOS(cob_sort_memory),(1024*1024),4294967294 /* max. guaranteed - 1 */},
+	{"COB_SORT_MEMORY","sort_memory",	"128M",	sortmemopts,GRP_FILE,ENV_SIZE,SETPOS(cob_sort_memory),(1024*1024),4294967294 /* max. guaranteed - 1 */},
+	{"COB_SORT_THREADS","sort_threads",	"1",	NULL,GRP_FILE,ENV_UINT,SETPOS(cob_sort_threads),1,64},
+	{"COB_SORT_DIRECT","sort_direct",	"0",	NULL,GRP_FILE,ENV_BOOL,SETPOS(cob_sort_direct)},
+	{"COB_SORT_COMPRESS","sort_compress",	"none",	compressopts,GRP_FILE,ENV_UINT|ENV_ENUM,SETPOS(cob_sort_compress)},
+	{"COB_MERGE_CHECK","merge_check",	"1",	NULL,GRP_FILE,ENV_BOOL,SETPOS(cob_merge_check)},
+	{"COB_SORT_STATS","sort_stats",		NULL,	NULL,GRP_FILE,ENV_FILE,SETPOS(cob_sort_stats)},
+	{"COB_TMPDIR","tmpdir",			NULL,	NULL,GRP_FILE,ENV_PATH,SETPOS(cob_tmpdir)},
 	{"COB_SYNC","sync",			"false",syncopts,GRP_FILE,ENV_BOOL,SETPOS(cob_do_sync)},
     {"COB_KEYCHECK","keycheck",     "on",NULL,GRP_FILE,ENV_BOOL,SETPOS(cob_keycheck)},
     {"COB_FILE_DICTIONARY","file_dictionary",     "min",dict_opts,GRP_FILE,ENV_UINT|ENV_ENUMVAL,SETPOS(cob_file_dict),0,3},
@@ -522,8 +539,21 @@ static struct config_tbl gc_conf[] = {
     {"COB_DUPS_AHEAD","dups_ahead",     "default",dups_opts,GRP_FILE,ENV_UINT|ENV_ENUMVAL,SETPOS(cob_file_dups),0,3},
     {"COB_SEQ_CONCAT_NAME","seq_concat_name","0",NULL,GRP_FILE,ENV_BOOL,SETPOS(cob_concat_name)},
     {"COB_SEQ_CONCAT_SEP","seq_concat_sep","+",NULL,GRP_FILE,ENV_CHAR,SETPOS(cob_concat_sep),1},
+	{"COB_SEQ_BUFFER","seq_buffer",		"0",	NULL,GRP_FILE,ENV_SIZE,SETPOS(cob_seq_buffer),0,(64 * 1024 * 1024)},
+	{"COB_WRITE_BUFFER","write_buffer",	"0",	NULL,GRP_FILE,ENV_SIZE,SETPOS(cob_write_buffer),0,(64 * 1024 * 1024)},
+	{"COB_FILE_MMAP","file_mmap",		"0",	NULL,GRP_FILE,ENV_BOOL,SETPOS(cob_file_mmap)},
+	{"COB_REL_SLOTMAP","rel_slotmap",	"0",	NULL,GRP_FILE,ENV_BOOL,SETPOS(cob_rel_slotmap)},
+	{"COB_FILE_COMPRESS","file_compress",	"none",	compressopts,GRP_FILE,ENV_UINT|ENV_ENUM,SETPOS(cob_file_compress)},
+	{"COB_SEQ_PREFETCH","seq_prefetch",	"0",	NULL,GRP_FILE,ENV_SIZE,SETPOS(cob_seq_prefetch),0,(64 * 1024 * 1024)},
 #ifdef  WITH_DB
 	{"DB_HOME", "db_home", 			NULL, 	NULL, GRP_FILE, ENV_FILE, SETPOS (bdb_home)},
+	{"COB_BDB_BULK_READ","bdb_bulk_read",	"64K",	NULL,GRP_FILE,ENV_SIZE,SETPOS(cob_bdb_bulk_read),0,(16 * 1024 * 1024)},
+#endif
+#if defined (WITH_LMDB)
+	{"COB_LMDB_COMMIT","lmdb_commit",	"0",	NULL,GRP_FILE,ENV_UINT,SETPOS(cob_lmdb_commit)},
+	{"COB_LMDB_COMMIT_TIME","lmdb_commit_time","0",	NULL,GRP_FILE,ENV_UINT,SETPOS(cob_lmdb_commit_time)},
+	{"COB_LMDB_MAPSIZE","lmdb_mapsize",	"0",	NULL,GRP_FILE,ENV_SIZE,SETPOS(cob_lmdb_mapsize)},
+	{"COB_LMDB_MAXSIZE","lmdb_maxsize",	"0",	NULL,GRP_FILE,ENV_SIZE,SETPOS(cob_lmdb_maxsize)},
 #endif
 	{"COB_DISPLAY_PRINT_PIPE", "display_print_pipe",		NULL,	NULL, GRP_SCREEN, ENV_STR, SETPOS (cob_display_print_pipe)},
 	{"COBPRINTER", "printer",		NULL,	NULL, GRP_HIDE, ENV_STR, SETPOS (cob_display_print_pipe)},
@@ -671,6 +701,14 @@ cob_exit_common (void)
 	if (cob_local_env) {
 		cob_free (cob_local_env);
 	}
+	if (cob_tmpdir_buff) {
+		cob_free (cob_tmpdir_buff);
+		cob_free (cob_tmpdirs);
+		cob_tmpdir_buff = NULL;
+		cob_tmpdirs = NULL;
+	}
+	cob_tmpdir_count = 0;
+	cob_tmpdirs_done = 0;
 
 	/* Free library routine stuff */
 
@@ -1609,30 +1647,6 @@ end:
 	return ret;
 }
 
-static int
-sort_compare (const void *data1, const void *data2)
-{
-	size_t		i;
-	int		cmp;
-	cob_field	f1;
-	cob_field	f2;
-
-	for (i = 0; i < sort_nkeys; ++i) {
-		f1 = f2 = *sort_keys[i].field;
-		f1.data = (unsigned char *)data1 + sort_keys[i].offset;
-		f2.data = (unsigned char *)data2 + sort_keys[i].offset;
-		if (COB_FIELD_IS_NUMERIC (&f1)) {
-			cmp = cob_numeric_cmp (&f1, &f2);
-		} else {
-			cmp = common_cmps (f1.data, f2.data, f1.size, sort_collate);
-		}
-		if (cmp != 0) {
-			return (sort_keys[i].tf_ascending == COB_ASCENDING) ? cmp : -cmp;
-		}
-	}
-	return 0;
-}
-
 static void
 cob_memcpy (cob_field *dst, const void *src, const size_t size)
 {
@@ -3298,30 +3312,43 @@ cob_is_lower (const cob_field *f)
 void
 cob_table_sort_init (const size_t nkeys, const unsigned char *collating_sequence)
 {
-	sort_nkeys = 0;
-	sort_keys = cob_malloc (nkeys * sizeof (cob_file_key));
+	struct cob_table_sort	*ts;
+
+	ts = cob_malloc (sizeof (struct cob_table_sort));
+	ts->keys = cob_malloc (nkeys * sizeof (cob_file_key));
 	if (collating_sequence) {
-		sort_collate = collating_sequence;
+		ts->collate = collating_sequence;
 	} else {
-		sort_collate = COB_MODULE_PTR->collating_sequence;
+		ts->collate = COB_MODULE_PTR->collating_sequence;
 	}
+	ts->next = table_sort;
+	table_sort = ts;
 }
 
 void
 cob_table_sort_init_key (cob_field *field, const int flag,
 			 const unsigned int offset)
 {
-	sort_keys[sort_nkeys].field = field;
-	sort_keys[sort_nkeys].tf_ascending = flag;
-	sort_keys[sort_nkeys].offset = offset;
-	sort_nkeys++;
+	struct cob_table_sort	*ts = table_sort;
+
+	ts->keys[ts->nkeys].field = field;
+	ts->keys[ts->nkeys].tf_ascending = flag;
+	ts->keys[ts->nkeys].offset = offset;
+	ts->nkeys++;
 }
 
+/* The keys are taken off the list before sorting, see cob_sort_table */
 void
 cob_table_sort (cob_field *f, const int n)
 {
-	qsort (f->data, (size_t) n, f->size, sort_compare);
-	cob_free (sort_keys);
+	struct cob_table_sort	*ts = table_sort;
+
+	table_sort = ts->next;
+	if (n > 1) {
+		cob_sort_table (f, (size_t)n, ts->keys, ts->nkeys, ts->collate);
+	}
+	cob_free (ts->keys);
+	cob_free (ts);
 }
 
 /* Run-time error checking */
@@ -4739,6 +4766,54 @@ check_valid_env_tmpdir (const char *envname)
 }
 
 
+/*
+ * Split the list of directories for temporary files given in COB_TMPDIR,
+ * or in TMPDIR if that holds more than one, invalid entries are skipped
+ */
+static void
+cob_tmpdirs_init (void)
+{
+	const char	*list;
+	char		*p;
+	char		*next;
+	size_t		size;
+	unsigned int	n;
+
+	cob_tmpdirs_done = 1;
+	list = cobsetptr ? cobsetptr->cob_tmpdir : NULL;
+	if (list == NULL || list[0] == 0) {
+		list = getenv ("TMPDIR");
+		if (list == NULL || strchr (list, PATHSEP_CHAR) == NULL) {
+			return;
+		}
+	}
+	cob_tmpdir_buff = cob_strdup (list);
+	for (n = 1, p = cob_tmpdir_buff; *p; p++) {
+		if (*p == PATHSEP_CHAR) {
+			n++;
+		}
+	}
+	cob_tmpdirs = cob_malloc (n * sizeof (char *));
+	for (p = cob_tmpdir_buff; p; p = next) {
+		next = strchr (p, PATHSEP_CHAR);
+		if (next) {
+			*next++ = 0;
+		}
+		size = strlen (p);
+		while (size > 1 && p[size - 1] == SLASH_CHAR) {
+			p[--size] = 0;
+		}
+		if (size == 0) {
+			continue;
+		}
+		if (check_valid_dir (p)) {
+			cob_runtime_warning ("Temporary directory %s is invalid, skipped", p);
+			continue;
+		}
+		cob_tmpdirs[cob_tmpdir_count++] = p;
+	}
+}
+
 /* return pointer to TMPDIR without trailing slash */
 static const char *
 cob_gettmpdir (void)
@@ -4746,6 +4821,15 @@ cob_gettmpdir (void)
 	const char	*tmpdir;
 	char	*tmp;
 
+	if (!cob_tmpdirs_done) {
+		cob_tmpdirs_init ();
+	}
+	/* With a list of directories in TMPDIR its first valid one is used */
+	if (cob_tmpdir_count > 0
+	 && (tmpdir = getenv ("TMPDIR")) != NULL
+	 && strchr (tmpdir, PATHSEP_CHAR) != NULL) {
+		(void)cob_setenv ("TMPDIR", cob_tmpdirs[0], 1);
+	}
 	if ((tmpdir = check_valid_env_tmpdir ("TMPDIR")) == NULL) {
 		tmp = NULL;
 #ifdef	_WIN32
@@ -4785,9 +4869,9 @@ cob_gettmpdir (void)
 	return tmpdir;
 }
 
-/* Set temporary file name */
-void
-cob_temp_name (char *filename, const char *ext)
+/* Set temporary file name in directory 'dir' */
+static void
+cob_temp_name_in (char *filename, const char *dir, const char *ext)
 {
 	int pid = cob_sys_getpid ();
 #ifndef HAVE_8DOT3_FILENAMES
@@ -4801,15 +4885,46 @@ cob_temp_name (char *filename, const char *ext)
 #endif
 	if (ext) {
 		snprintf (filename, (size_t)COB_FILE_MAX, TEMP_EXT_SCHEMA,
-			cob_gettmpdir (), SLASH_CHAR, pid, cob_temp_iteration, ext);
+			dir, SLASH_CHAR, pid, cob_temp_iteration, ext);
 	} else {
 		snprintf (filename, (size_t)COB_FILE_MAX, TEMP_SORT_SCHEMA,
-			cob_gettmpdir (), SLASH_CHAR, pid, cob_temp_iteration);
+			dir, SLASH_CHAR, pid, cob_temp_iteration);
 	}
 #undef TEMP_EXT_SCHEMA
 #undef TEMP_SORT_SCHEMA
 }
 
+/* Set temporary file name */
+void
+cob_temp_name (char *filename, const char *ext)
+{
+	cob_temp_name_in (filename, cob_gettmpdir (), ext);
+}
+
+/* Number of directories for SORT work files */
+unsigned int
+cob_temp_dir_count (void)
+{
+	if (!cob_tmpdirs_done) {
+		cob_tmpdirs_init ();
+	}
+	return cob_tmpdir_count > 0 ? cob_tmpdir_count : 1;
+}
+
+/* Set name of a SORT work file in the 'n'-th temporary directory */
+void
+cob_temp_name_dir (char *filename, const unsigned int n)
+{
+	if (!cob_tmpdirs_done) {
+		cob_tmpdirs_init ();
+	}
+	if (cob_tmpdir_count == 0) {
+		cob_temp_name_in (filename, cob_gettmpdir (), NULL);
+	} else {
+		cob_temp_name_in (filename, cob_tmpdirs[n % cob_tmpdir_count], NULL);
+	}
+}
+
 void
 cob_incr_temp_iteration (void)
 {
@@ -6463,6 +6578,7 @@ set_config_val (char *value, int pos)
 	char	*ptr = value, *str;
 	cob_s64_t	numval = 0;
 	int 	i, data_type, data_len, slen;
+	int 	from_enum = 0;
 	size_t	data_loc;
 
 	data_type = gc_conf[pos].data_type;
@@ -6476,6 +6592,7 @@ set_config_val (char *value, int pos)
 		for (i = 0; gc_conf[pos].enums[i].match != NULL; i++) {
 			if (strcasecmp (value, gc_conf[pos].enums[i].match) == 0) {
 				ptr = value = (char *)gc_conf[pos].enums[i].value;
+				from_enum = 1;
 				break;
 			}
 			if ((data_type & ENV_ENUMVAL) && strcasecmp (value, gc_conf[pos].enums[i].value) == 0) {
@@ -6544,7 +6661,8 @@ set_config_val (char *value, int pos)
 				ptr++;
 				break;
 			case 'M':
-				if (numval < 4001) {
+				if (numval < 4001
+				 || sizeof (size_t) > 4) {
 					numval = numval * 1024 * 1024;
 				} else {
 					/* use max. guaranteed value for unsigned long
@@ -6554,7 +6672,8 @@ set_config_val (char *value, int pos)
 				ptr++;
 				break;
 			case 'G':
-				if (numval < 4) {
+				if (numval < 4
+				 || sizeof (size_t) > 4) {
 					numval = numval * 1024 * 1024 * 1024;
 				} else {
 					/* use max. guaranteed value for unsigned long
@@ -6574,13 +6693,16 @@ set_config_val (char *value, int pos)
 		if (sign == '-') {
 			numval = -numval;
 		}
+		/* A value given by word, like 'auto', is not checked for range */
 		if (gc_conf[pos].min_value > 0
+		 && !from_enum
 		 && numval < gc_conf[pos].min_value) {
 			conf_runtime_error_value (value, pos);
 			conf_runtime_error (1, _("minimum value: %lu"), gc_conf[pos].min_value);
 			return 1;
 		}
 		if (gc_conf[pos].max_value > 0
+		 && !from_enum
 		 && numval > gc_conf[pos].max_value) {
 			conf_runtime_error_value (value, pos);
 			conf_runtime_error (1, _("maximum value: %lu"), gc_conf[pos].max_value);
@@ -8646,13 +8768,11 @@ cob_init (const int argc, char **argv)
 	cob_last_sfile = NULL;
 	commlnptr = NULL;
 	basext = NULL;
-	sort_keys = NULL;
-	sort_collate = NULL;
+	table_sort = NULL;
 	cob_source_file = NULL;
 	exit_hdlrs = NULL;
 	hdlrs = NULL;
 	commlncnt = 0;
-	sort_nkeys = 0;
 	cob_source_line = 0;
 	cob_local_env_size = 0;
 
@@ -949,6 +949,12 @@ enum cob_file_access {
 #define COB_FILE_LS_DEFAULT	(1 << 7)/* Defaulted to LINE SEQUENTIAL */
 									/* Default is longer than max get truncated & skip to LF */
 
+/* File: 'compress' compression of SEQUENTIAL and LINE SEQUENTIAL files */
+#define COB_COMPRESS_NONE	0
+#define COB_COMPRESS_GZIP	1
+#define COB_COMPRESS_ZSTD	2
+#define COB_COMPRESS_AUTO	3	/* by file name suffix .gz / .zst */
+
 /* Sharing option */
 
 #define COB_SHARE_READ_ONLY	(1U << 0)
@@ -1590,7 +1596,9 @@ typedef struct __cob_file {
 	unsigned int		flag_is_std:1;		/* LINE SEQUENTIAL as 'stdin/stdout/stderr' */
 	unsigned int		flag_is_concat:1;	/* SEQUENTIAL concatenated file names */
 	unsigned int		flag_needs_cr;		/* Needs CR */
-	unsigned int		unused_bits:3;
+	unsigned int		flag_mmap:1;		/* SEQUENTIAL/RELATIVE: map file opened INPUT */
+	unsigned int		flag_relmap:1;		/* RELATIVE: keep map of used slots */
+	unsigned int		unused_bits:1;
 
 	cob_field			*last_key;		/* Last field used as 'key' for I/O */
 	unsigned char		last_operation;		/* Most recent I/O operation */
@@ -1621,8 +1629,20 @@ typedef struct __cob_file {
 	void				*fileout;		/* output side of bi-directional pipe 'FILE*' */
 	int					fdout;			/* output side of bi-directional pipe 'fd' */
 	int					limitreads;		/* Database should LIMIT rows read */
-	char				*org_filename;	/* Full concatenated file name */
-	char				*nxt_filename;	/* Next position in org_filename */
+	char				*org_filename;	/* Concatenated file names, split at the separator */
+	char				*nxt_filename;	/* Name of the next member in org_filename */
+	void				*iobuf;			/* I/O buffer for SEQUENTIAL/RELATIVE files */
+	size_t				iobuf_size;		/* Size of read-ahead buffer, 0 = not buffered */
+	size_t				wrbuf_size;		/* Size of write-behind buffer, 0 = not buffered */
+	void				*prefetch;		/* Prefetch thread for SEQUENTIAL/LINE SEQUENTIAL input */
+	size_t				prefetch_size;	/* Distance to read ahead, 0 = no prefetch */
+	void				*relmap;		/* Map of used slots of RELATIVE file */
+	void				*zstream;		/* Compressor state of SEQUENTIAL/LINE SEQUENTIAL file */
+	unsigned char		compress;		/* Compression, see COB_COMPRESS_xxx */
+	void				*concat;		/* Members of concatenated input */
+	size_t				map_size;		/* Initial size of LMDB map, 0 = default */
+	size_t				map_max;		/* Maximum size of LMDB map, 0 = no limit */
+	size_t				expect_recs;	/* Expected number of records, 0 = unknown */
 } cob_file;
 
 
@@ -2747,6 +2767,8 @@ COB_EXPIMP void cob_start	(cob_file *, const int, cob_field *,
 				 cob_field *, cob_field *);
 COB_EXPIMP void cob_write	(cob_file *, cob_field *, const int,
 				 cob_field *, const unsigned int);
+COB_EXPIMP size_t cob_write_multi	(cob_file *, const void *, size_t, size_t);
+COB_EXPIMP cob_s64_t cob_file_input_size	(cob_file *, cob_s64_t *);
 
 COB_EXPIMP void cob_delete_file	(cob_file *, cob_field *, const int);
 COB_EXPIMP void cob_unlock_file	(cob_file *, cob_field *);
@@ -2806,9 +2828,33 @@ COB_EXPIMP int cob_sys_mkdir		(unsigned char *);
 COB_EXPIMP int cob_sys_copyfile		(unsigned char *, unsigned char *,
 					 unsigned char *);
 COB_EXPIMP int cob_sys_file_info	(unsigned char *, unsigned char *);
+
+/* Memory map of an INDEXED file (LMDB), sizes in bytes */
+typedef struct __cob_file_map_stats {
+	cob_u64_t	size;		/* Current size of the map */
+	cob_u64_t	used;		/* Part of the map in use */
+	cob_u64_t	max;		/* Size the map may grow to, 0 = no limit */
+} cob_file_map_stats;
+
+COB_EXPIMP int cob_file_get_map_stats	(cob_file *, cob_file_map_stats *);
+COB_EXPIMP int cob_sys_file_map_stats	(unsigned char *, unsigned char *);
 COB_EXPIMP int cob_sys_file_delete	(unsigned char *, unsigned char *);
 
 /* SORT routines */
+
+/* Statistics of a SORT / MERGE, times in microseconds */
+typedef struct __cob_sort_stats {
+	cob_s64_t	records_in;	/* Records RELEASEd or read by MERGE */
+	cob_s64_t	records_out;	/* Records RETURNed */
+	cob_s64_t	bytes;		/* Bytes of the records RELEASEd */
+	cob_s64_t	memory;		/* Memory used for records */
+	cob_s64_t	runs;		/* Runs written to temporary files */
+	cob_s64_t	passes;		/* Merge passes, the final one included */
+	cob_s64_t	temp_bytes;	/* Bytes written to temporary files */
+	cob_s64_t	wall[3];	/* Elapsed time of input, sort, output */
+	cob_s64_t	cpu[3];		/* CPU time of input, sort, output */
+} cob_sort_stats;
+
 COB_EXPIMP void	cob_file_sort_init	(cob_file *, const unsigned int,
 					 const unsigned char *,
 					 void *, cob_field *);
@@ -2816,9 +2862,12 @@ COB_EXPIMP void	cob_file_sort_init_key	(cob_file *, cob_field *,
 					 const int, const unsigned int);
 COB_EXPIMP void	cob_file_sort_close	(cob_file *);
 COB_EXPIMP void	cob_file_sort_using	(cob_file *, cob_file *);
+COB_EXPIMP void	cob_file_merge_using	(cob_file *, cob_file *);
 COB_EXPIMP void	cob_file_sort_giving	(cob_file *, const size_t, ...);
 COB_EXPIMP void	cob_file_release	(cob_file *);
 COB_EXPIMP void	cob_file_return		(cob_file *);
+COB_EXPIMP int	cob_sort_get_stats	(cob_file *, cob_sort_stats *);
+COB_EXPIMP int	cob_sys_sort_stats	(unsigned char *);
 
 /***************************/
 /* Functions in reportio.c */
@@ -74,6 +74,7 @@ static void		*record_lock_object = NULL;
 static size_t	rlo_size = 0;
 static unsigned int	bdb_lock_id = 0;
 static int		bdb_join = 1;
+static unsigned int	bdb_updates = 0;	/* Updates by this process, drop bulk reads */
 
 #define DB_PUT(db,flags)	db->put (db, NULL, &p->key, &p->data, flags)
 #define DB_GET(db,flags)	db->get (db, NULL, &p->key, &p->data, flags)
@@ -84,10 +85,12 @@ static int		bdb_join = 1;
 #define DB_SEQ(db,flags)	db->get (db, &p->key, &p->data, flags)
 #define DB_CPUT(db,flags)	db->put (db, &p->key, &p->data, flags)
 #define DB_CDEL(db,flags)	db->del (db, flags)
+#define DB_BULK(db,key,data,flags)	db->get (db, key, data, (flags) | DB_MULTIPLE_KEY)
 #else
 #define DB_SEQ(db,flags)	db->c_get (db, &p->key, &p->data, flags)
 #define DB_CPUT(db,flags)	db->c_put (db, &p->key, &p->data, flags)
 #define DB_CDEL(db,flags)	db->c_del (db, flags)
+#define DB_BULK(db,key,data,flags)	db->c_get (db, key, data, (flags) | DB_MULTIPLE_KEY)
 #endif
 #define	cob_dbtsize_t		u_int32_t
 
@@ -98,6 +101,14 @@ static int		bdb_join = 1;
 	key.size = (cob_dbtsize_t) fld->size
 #define COB_MAX_BDB_LOCKS 32
 
+/* Record in the buffer of a bulk read */
+struct bdb_bulk_rec {
+	void		*key;
+	void		*data;
+	cob_dbtsize_t	keylen;
+	cob_dbtsize_t	datalen;
+};
+
 struct indexed_file {
 	DB		**db;		/* Database handlers */
 	DBC		**cursor;
@@ -125,6 +136,13 @@ struct indexed_file {
 	DB_LOCK		bdb_file_lock;
 	DB_LOCK		bdb_record_lock;
 	DB_LOCK		*bdb_locks;
+	unsigned char	*bulk;		/* Records read ahead by READ NEXT */
+	struct bdb_bulk_rec	*bulk_rec;	/* Records in 'bulk' */
+	unsigned int	bulk_max;	/* Size of 'bulk_rec' */
+	unsigned int	bulk_count;	/* Number of records in 'bulk', 0 = none */
+	unsigned int	bulk_pos;	/* Record of 'bulk' read last */
+	unsigned int	bulk_gen;	/* 'bdb_updates' when 'bulk' was filled */
+	int		bulk_off;	/* Bulk reads do not work for this file */
 };
 
 static unsigned int
@@ -237,6 +255,151 @@ bdb_close_index(cob_file *f, int index)
 	return 1;
 }
 
+/*
+ * Bulk READ NEXT: sequential reads on the primary key without record lock
+ * fetch the records that follow with DB_MULTIPLE_KEY into a buffer of
+ * COB_BDB_BULK_READ bytes and serve the next READ NEXT/PREVIOUS from it;
+ * the buffer is dropped by START, random READ and any update of an
+ * INDEXED file by this process
+ */
+
+/* Fill the bulk buffer with the records after key 'from',
+   or from the first record if 'from' is NULL */
+static int
+bdb_bulk_fill (cob_file *f, const unsigned char *from)
+{
+	struct indexed_file	*p;
+	DBT		key, data;
+	void		*ptr, *rkey, *rdata;
+	const unsigned char	*skip;
+	cob_dbtsize_t	rklen, rdlen, fromlen;
+	u_int32_t	flags;
+	size_t		size;
+	int		ret;
+
+	p = f->file;
+	p->bulk_count = 0;
+	size = (file_setptr->cob_bdb_bulk_read + 1023) / 1024 * 1024;
+	if (p->bulk == NULL) {
+		p->bulk = cob_malloc (size);
+	}
+	memset (&key, 0, sizeof (DBT));
+	memset (&data, 0, sizeof (DBT));
+	fromlen = 0;
+	skip = from;
+	if (from != NULL) {
+		fromlen = (cob_dbtsize_t) db_keylen (f, 0);
+		key.data = (void *)from;
+		key.size = fromlen;
+		flags = DB_SET_RANGE;
+	} else {
+		flags = DB_FIRST;
+	}
+	data.data = p->bulk;
+	data.ulen = (cob_dbtsize_t) size;
+	data.flags = DB_DBT_USERMEM;
+	p->db[0]->cursor (p->db[0], NULL, &p->cursor[0], 0);
+	do {
+		ret = DB_BULK (p->cursor[0], &key, &data, flags);
+		if (ret != 0) {
+			break;
+		}
+		DB_MULTIPLE_INIT (ptr, &data);
+		for (;;) {
+			DB_MULTIPLE_KEY_NEXT (ptr, &data, rkey, rklen, rdata, rdlen);
+			if (ptr == NULL) {
+				break;
+			}
+			if (skip != NULL) {	/* Skip the record read last */
+				if (rklen == fromlen
+				 && memcmp (rkey, skip, (size_t)rklen) == 0) {
+					skip = NULL;
+					continue;
+				}
+				skip = NULL;
+			}
+			if (p->bulk_count >= p->bulk_max) {
+				p->bulk_max = p->bulk_max ? p->bulk_max * 2 : 64;
+				p->bulk_rec = cob_realloc (p->bulk_rec,
+					p->bulk_count * sizeof (struct bdb_bulk_rec),
+					p->bulk_max * sizeof (struct bdb_bulk_rec));
+			}
+			p->bulk_rec[p->bulk_count].key = rkey;
+			p->bulk_rec[p->bulk_count].keylen = rklen;
+			p->bulk_rec[p->bulk_count].data = rdata;
+			p->bulk_rec[p->bulk_count].datalen = rdlen;
+			p->bulk_count++;
+		}
+		flags = DB_NEXT;	/* The buffer only held the record read last */
+	} while (p->bulk_count == 0);
+	bdb_close_cursor (f);
+	if (ret != 0) {
+		p->bulk_count = 0;
+		if (ret != DB_NOTFOUND) {
+			p->bulk_off = 1;	/* Buffer smaller than a page or a record */
+		}
+		return ret;
+	}
+	p->bulk_pos = 0;
+	p->bulk_gen = bdb_updates;
+	return 0;
+}
+
+/* READ NEXT/PREVIOUS from the bulk buffer,
+   returns -1 if the record has to be read from the file */
+static int
+bdb_bulk_read (cob_file *f, const int read_opts)
+{
+	struct indexed_file	*p;
+	struct bdb_bulk_rec	*r;
+	int			ret;
+
+	p = f->file;
+	if (p->bulk_gen != bdb_updates
+	 || f->flag_first_read) {
+		p->bulk_count = 0;
+	}
+	if (read_opts & COB_READ_PREVIOUS) {
+		if (p->bulk_count == 0
+		 || p->bulk_pos == 0) {
+			p->bulk_count = 0;
+			return -1;
+		}
+		p->bulk_pos--;
+	} else if (f->flag_first_read) {
+		return -1;	/* Record found by OPEN or START, checked there */
+	} else if (p->bulk_count > 0
+		&& p->bulk_pos + 1 < p->bulk_count) {
+		p->bulk_pos++;
+	} else {
+		ret = bdb_bulk_fill (f, f->flag_begin_of_file ? NULL : p->last_readkey[0]);
+		if (ret == DB_NOTFOUND) {
+			return COB_STATUS_10_END_OF_FILE;
+		}
+		if (ret != 0) {
+			return -1;
+		}
+	}
+
+	r = &p->bulk_rec[p->bulk_pos];
+	memcpy (p->last_readkey[0], r->key, (size_t)r->keylen);
+	p->key.data = p->last_readkey[0];
+	p->key.size = r->keylen;
+	p->data.data = r->data;
+	p->data.size = r->datalen;
+	p->start_cond = 0;
+
+	f->record->size = p->data.size;
+	if (f->record->size > f->record_max) {
+		f->record->size = f->record_max;
+		ret = COB_STATUS_43_READ_NOT_DONE;
+	} else {
+		ret = COB_STATUS_00_SUCCESS;
+	}
+	memcpy (f->record->data, p->data.data, f->record->size);
+	return ret;
+}
+
 
 /* Local functions */
 
@@ -865,6 +1028,7 @@ ix_bdb_start_internal (cob_file *f, const int cond, cob_field *key,
 	ret = 0;
 	p = f->file;
 	p->start_cond = cond;
+	p->bulk_count = 0;
 	/* Look up for the key */
 	key_index = db_findkey (f, key, &fullkeylen, &partlen);
 	if (key_index < 0) {
@@ -1474,6 +1638,10 @@ ix_bdb_close (cob_file_api *a, cob_file *f, const int opt)
 	cob_free (p->cursor);
 	if (p->bdb_locks)
 		cob_free (p->bdb_locks);
+	if (p->bulk)
+		cob_free (p->bulk);
+	if (p->bulk_rec)
+		cob_free (p->bulk_rec);
 	if (bdb_env != NULL) {
 		bdb_env->lock_id_free (bdb_env, p->bdb_lock_id);
 	}
@@ -1611,6 +1779,23 @@ ix_bdb_read_next (cob_file_api *a, cob_file *f, const int read_opts)
 		bdb_opts &= ~COB_READ_LOCK;
 	}
 
+	/* The bulk buffer only sees updates done by this process,
+	   so it is used only if no other process may update the file */
+	if (p->key_index == 0
+	 && file_setptr->cob_bdb_bulk_read > 0
+	 && !p->bulk_off
+	 && !skip_lock
+	 && !(bdb_opts & COB_READ_LOCK)
+	 && (f->flag_file_lock
+	  || (f->open_mode == COB_OPEN_INPUT
+	   && !(f->share_mode & COB_SHARE_ALL_OTHER)))) {
+		ret = bdb_bulk_read (f, bdb_opts);
+		if (ret >= 0) {
+			return ret;
+		}
+	}
+	p->bulk_count = 0;
+
 	if (bdb_opts & COB_READ_PREVIOUS) {
 		if (f->flag_end_of_file) {
 			nextprev = DB_LAST;
@@ -1868,6 +2053,7 @@ ix_bdb_write (cob_file_api *a, cob_file *f, const int opt)
 		return COB_STATUS_48_OUTPUT_DENIED;
 	}
 	p = f->file;
+	bdb_updates++;
 	if (!(f->lock_mode & COB_LOCK_MULTIPLE)) {
 		bdb_unlock_all (f);
 	}
@@ -1907,6 +2093,7 @@ ix_bdb_delete (cob_file_api *a, cob_file *f)
 	if (f->flag_nonexistent) {
 		return COB_STATUS_49_I_O_DENIED;
 	}
+	bdb_updates++;
 	ret = ix_bdb_delete_internal (f, 0, 0);
 	bdb_close_cursor (f);
 	return ret;
@@ -1923,6 +2110,7 @@ ix_bdb_rewrite (cob_file_api *a, cob_file *f, const int opt)
 	if (f->flag_nonexistent) {
 		return COB_STATUS_49_I_O_DENIED;
 	}
+	bdb_updates++;
 	if (!(f->lock_mode & COB_LOCK_MULTIPLE)) {
 		bdb_unlock_all (f);
 	}
@@ -37,6 +37,17 @@
  */
 #define cobglobptr file_globptr
 #define cobsetptr file_setptr
+#include "config.h"
+
+/* include decimal definitions for the normalization of SORT keys */
+#ifdef	HAVE_GMP_H
+#include <gmp.h>
+#elif defined HAVE_MPIR_H
+#include <mpir.h>
+#else
+#error either HAVE_GMP_H or HAVE_MPIR_H needs to be defined
+#endif
+
 #include "fileio.h"
 #include "cobcapi.h"	/* for helper functions */
 #ifdef HAVE_DLFCN_H
@@ -87,34 +98,59 @@ struct file_list {
 #define COBSORTABORT		2
 #define COBSORTFILEERR		3
 #define COBSORTNOTOPEN		4
+#define COBSORTSEQERR		5
 
 
 /* Sort item */
 struct cobitem {
 	struct cobitem		*next;
-	unsigned char		end_of_block;
-	unsigned char		block_byte;
-	unsigned char		unique[sizeof (size_t)];
-	unsigned char		item[1];
+	unsigned char		run_bit;	/* Run of replacement selection */
+	unsigned char		data[1];	/* Keys, sequence, record */
 };
 
 /* Sort memory chunk */
 struct sort_mem_struct {
 	struct sort_mem_struct	*next;
 	unsigned char		*mem_ptr;
+	size_t			size;	/* Size of 'mem_ptr' */
+	int			map;	/* 'mem_ptr' is mapped, not allocated */
 };
 
-/* Sort queue structure */
-struct queue_struct {
-	struct cobitem		*first;
-	struct cobitem		*last;
-	size_t			count;
+/* Entry of the array sorted in memory */
+struct cob_sort_entry {
+	cob_u64_t		prefix;	/* Leading bytes of the keys */
+	unsigned char		*rec;	/* 'data' of the item */
 };
 
-/* Sort temporary file structure */
-struct file_struct {
-	FILE			*fp;
-	size_t			count;	/* Count of blocks in temporary files */
+/* Sorted run in a temporary file */
+struct cob_sort_run {
+	off_t			off;	/* Start in the file */
+	cob_s64_t		count;	/* Number of records */
+	cob_s64_t		size;	/* Bytes in the file */
+	int			file;	/* Index in 'tmp_fd' */
+};
+
+/* Reader of a run while merging */
+struct cob_sort_reader {
+	struct cob_sort_entry	cur;	/* Current record */
+	unsigned char		*buf;	/* 'rpad' bytes, then the block read */
+	size_t			len;	/* End of the data in buffer */
+	size_t			pos;	/* Offset of current record */
+	cob_s64_t		rest;	/* Bytes of the run not yet read */
+	off_t			off;	/* Next position to read */
+	unsigned char		*zbuf;	/* 'zpad' bytes, then compressed block */
+	size_t			zlen;	/* End of the data in 'zbuf' */
+	size_t			zpos;	/* Offset of the next frame */
+	int			fd;
+};
+
+/* Normalized sort key */
+struct cob_sort_key {
+	cob_field		field;		/* Key, 'data' set per record */
+	unsigned int		offset;		/* Offset in the record */
+	unsigned int		width;		/* Bytes of a numeric magnitude */
+	int			kind;		/* COB_SORT_KEY_xxx */
+	int			desc;		/* DESCENDING */
 };
 
 /* Sort base structure */
@@ -124,6 +160,25 @@ struct cobsort {
 	void			*sort_return;
 	cob_field		*fnstatus;
 	struct sort_mem_struct	*mem_base;
+	struct cob_sort_entry	*entry;		/* Records in memory */
+	struct cob_sort_entry	*entry_tmp;	/* Target of parallel merge */
+	struct cobitem		*spare;		/* Free item while selecting */
+	struct cob_sort_key	*nkey;		/* Normalized keys */
+	struct cob_sort_run	*run;		/* Runs on disk */
+	struct cob_sort_reader	*reader;	/* Runs being merged */
+	struct cob_sort_reader	**heap;		/* Readers by current record */
+	unsigned char		*rbuf;		/* Buffers of the readers */
+	unsigned char		*wbuf;		/* Buffer for writing runs */
+	void			*rbuf_mem;	/* Allocation of 'rbuf' */
+	void			*wbuf_mem;	/* Allocation of 'wbuf' */
+	unsigned char		*zraw;		/* Records of the frame written */
+	cob_file		**merge_file;	/* USING files of a MERGE */
+	int			*tmp_fd;	/* Temporary files */
+	off_t			*tmp_end;	/* Size of their data */
+	size_t			entry_count;
+	size_t			entry_max;
+	size_t			entry_tmp_max;
+	size_t			entry_next;	/* Next entry to RETURN */
 	size_t			unique;
 	size_t			size;
 	size_t			alloc_size;
@@ -131,15 +186,47 @@ struct cobsort {
 	size_t			mem_used;
 	size_t			mem_total;
 	size_t			chunk_size;
-	size_t			r_size;
-	size_t			w_size;
+	size_t			mem_limit;	/* Memory for records in memory */
+	size_t			mem_avail;	/* Share of memory, for 'auto' */
+	cob_s64_t		mem_hint;	/* Records of USING, -1 = unknown */
+	size_t			r_size;		/* Size of an item's data */
+	size_t			key_size;	/* Size of the normalized keys */
+	size_t			data_off;	/* Offset of the record in data */
+	size_t			cmp_size;	/* Bytes compared with memcmp */
+	size_t			run_count;
+	size_t			run_max;
+	size_t			wrun;		/* Run being written */
+	size_t			wbuf_size;
+	size_t			wlen;		/* Bytes in 'wbuf' */
+	size_t			rpad;		/* Room for a record before a block */
+	size_t			zframe;		/* Record bytes per frame */
+	size_t			zbound;		/* Maximum compressed frame */
+	size_t			zpad;		/* Room for a frame before a block */
+	size_t			zlen;		/* Bytes in 'zraw' */
+	size_t			nreaders;
+	size_t			block;		/* Buffer size per reader */
+	size_t			merge_count;	/* Entries in 'merge_file' */
 	size_t			switch_to_file;
 	unsigned int		retrieving;
 	unsigned int		files_used;
-	int			destination_file;
-	int			retrieval_queue;
-	struct queue_struct	queue[4];
-	struct file_struct	file[4];
+	unsigned int		selecting;	/* Replacement selection active */
+	unsigned int		run_bit;	/* 'run_bit' of the current run */
+	unsigned int		prefix_size;	/* Bytes in the prefix */
+	unsigned int		norm_keys;	/* Keys that are normalized */
+	unsigned int		all_norm;	/* All keys are normalized */
+	unsigned int		use_dec;	/* 'dec' is initialized */
+	cob_decimal		dec;		/* Normalization of decimals */
+	unsigned int		threads;	/* Threads sorting in memory */
+	unsigned int		ndirs;		/* Temporary directories used */
+	unsigned int		wset;		/* Set of files written */
+	unsigned int		zcodec;		/* COB_COMPRESS_xxx of the runs */
+	unsigned int		merge_step;	/* Record of heap [0] returned */
+	unsigned int		phase;		/* Phase timed, 3 = none */
+	int			merge_err;	/* MERGE ended with this error */
+	int			wfile;		/* File being written */
+	cob_s64_t		phase_wall;	/* Start of the phase */
+	cob_s64_t		phase_cpu;
+	cob_sort_stats		stats;
 };
 
 /* End SORT definitions */
@@ -156,6 +243,9 @@ static unsigned int	check_eop_status = 0;
 
 static struct file_list	*file_cache = NULL;
 
+static cob_sort_stats	last_sort_stats;	/* Of the SORT closed last */
+static int		last_sort_done = 0;
+
 static char		*file_open_env = NULL;
 static char		*file_open_name = NULL;
 static char		*file_open_buff = NULL;
@@ -199,6 +289,7 @@ static int dummy_91			() {return COB_STATUS_91_NOT_AVAILABLE;};
 static int cob_set_file_format(cob_file *, char *, int);
 static void cob_set_file_defaults (cob_file *);
 static int cob_savekey (cob_file *f, int idx, unsigned char *data);
+static void cob_relmap_free (cob_file *);
 static int cob_file_open	(cob_file_api *, cob_file *, char *, const int, const int);
 static int cob_file_close	(cob_file_api *, cob_file *, const int);
 static int cob_file_write_opt	(cob_file *, const int);
@@ -393,6 +484,570 @@ get_io_ptr (cob_file *f)
 	return f->io_routine;
 }
 
+/*
+ * Streaming compression for SEQUENTIAL and LINE SEQUENTIAL files
+ * The codec sits between the record routines and 'fd'; LINE SEQUENTIAL
+ * files (and ADVANCING of SEQUENTIAL files) use a 'FILE *' made with
+ * fopencookie() on top of the codec in place of the original one.
+ * While reading, the last decompressed data is kept in a window so the
+ * file can still be positioned back to the start of the current record;
+ * while writing, the file can only be positioned at its end
+ */
+#if defined (COB_USE_COMPRESS)
+#define COB_ZBLOCK	(256 * 1024)	/* Size of compressed data buffer */
+#define COB_ZKEEP	(64 * 1024)	/* Minimum data kept for positioning back */
+
+struct cob_zstream {
+	int		type;		/* COB_COMPRESS_GZIP or COB_COMPRESS_ZSTD */
+	int		fd;		/* File with compressed data */
+	int		wrt;		/* Compressing */
+	int		eof;		/* No more compressed data in 'fd' */
+	int		err;		/* Codec or I/O error */
+	int		ended;		/* Stream (member/frame) is complete */
+	FILE		*raw;		/* Original 'FILE *' of the file */
+	unsigned char	*in;		/* Compressed data */
+	size_t		inlen;		/* Bytes of valid data in 'in' */
+	size_t		inpos;		/* Next byte of 'in' for the decompressor */
+	unsigned char	*win;		/* Window of decompressed data */
+	size_t		wsize;		/* Allocated size of 'win' */
+	size_t		wlen;		/* Bytes of valid data in 'win' */
+	size_t		wpos;		/* Next byte to be returned from 'win' */
+	size_t		keep;		/* Data kept in 'win' when it is slid */
+	off_t		wbase;		/* Logical position of win[0] */
+#if defined (HAVE_ZLIB)
+	z_stream	gz;
+#endif
+#if defined (HAVE_ZSTD)
+	ZSTD_CStream	*zc;
+	ZSTD_DStream	*zd;
+#endif
+};
+
+static struct cob_zstream *
+cob_zs_new (int type, int fd, int wrt, size_t keep)
+{
+	struct cob_zstream	*zs;
+	int		ok = 0;
+
+	zs = cob_malloc (sizeof (struct cob_zstream));
+	zs->type = type;
+	zs->fd = fd;
+	zs->wrt = wrt;
+	zs->ended = 1;
+	zs->in = cob_malloc (COB_ZBLOCK);
+	if (wrt) {
+		/* OUTPUT truncates and EXTEND appends a new member/frame */
+		zs->wbase = lseek (fd, 0, SEEK_END);
+	} else {
+		zs->wbase = lseek (fd, 0, SEEK_CUR);
+		zs->keep = keep + COB_ZKEEP;
+		zs->wsize = zs->keep + COB_ZBLOCK;
+		zs->win = cob_malloc (zs->wsize);
+	}
+	if (zs->wbase < 0)
+		zs->wbase = 0;
+#if defined (HAVE_ZLIB)
+	if (type == COB_COMPRESS_GZIP) {
+		if (wrt) {
+			ok = deflateInit2 (&zs->gz, 1, Z_DEFLATED, 15 + 16,
+					8, Z_DEFAULT_STRATEGY) == Z_OK;
+		} else {
+			/* 15 + 32: gzip or zlib header is detected */
+			ok = inflateInit2 (&zs->gz, 15 + 32) == Z_OK;
+		}
+	}
+#endif
+#if defined (HAVE_ZSTD)
+	if (type == COB_COMPRESS_ZSTD) {
+		if (wrt) {
+			zs->zc = ZSTD_createCStream ();
+			ok = zs->zc != NULL
+			  && !ZSTD_isError (ZSTD_initCStream (zs->zc, 3));
+		} else {
+			zs->zd = ZSTD_createDStream ();
+			ok = zs->zd != NULL
+			  && !ZSTD_isError (ZSTD_initDStream (zs->zd));
+		}
+	}
+#endif
+	if (!ok) {
+		zs->err = 1;
+	}
+	return zs;
+}
+
+static void
+cob_zs_free (struct cob_zstream *zs)
+{
+#if defined (HAVE_ZLIB)
+	if (zs->type == COB_COMPRESS_GZIP) {
+		if (zs->wrt) {
+			(void)deflateEnd (&zs->gz);
+		} else {
+			(void)inflateEnd (&zs->gz);
+		}
+	}
+#endif
+#if defined (HAVE_ZSTD)
+	if (zs->zc)
+		ZSTD_freeCStream (zs->zc);
+	if (zs->zd)
+		ZSTD_freeDStream (zs->zd);
+#endif
+	if (zs->win)
+		cob_free (zs->win);
+	cob_free (zs->in);
+	cob_free (zs);
+}
+
+/* Logical (uncompressed) file position */
+static off_t
+cob_zs_tell (struct cob_zstream *zs)
+{
+	return zs->wbase + (off_t)zs->wpos;
+}
+
+/* Write out the compressed data */
+static int
+cob_zs_put (struct cob_zstream *zs)
+{
+	size_t	done = 0;
+	int	wr;
+
+	while (done < zs->inlen) {
+		wr = (int)write (zs->fd, zs->in + done, zs->inlen - done);
+		if (wr <= 0) {
+			zs->err = 1;
+			return -1;
+		}
+		done += wr;
+	}
+	zs->inlen = 0;
+	return 0;
+}
+
+/*
+ * Compress 'len' bytes; with 'fin' set the stream is finished
+ * and all compressed data is written out
+ */
+static int
+cob_zs_deflate (struct cob_zstream *zs, const void *data, size_t len, int fin)
+{
+	int	more = 1;
+
+	if (zs->err)
+		return -1;
+	zs->ended = 0;
+#if defined (HAVE_ZLIB)
+	if (zs->type == COB_COMPRESS_GZIP) {
+		int	r;
+		zs->gz.next_in = (Bytef *)data;
+		zs->gz.avail_in = (uInt)len;
+		while (more) {
+			zs->gz.next_out = zs->in + zs->inlen;
+			zs->gz.avail_out = (uInt)(COB_ZBLOCK - zs->inlen);
+			r = deflate (&zs->gz, fin ? Z_FINISH : Z_NO_FLUSH);
+			if (r != Z_OK
+			 && r != Z_STREAM_END
+			 && r != Z_BUF_ERROR) {
+				zs->err = 1;
+				return -1;
+			}
+			zs->inlen = COB_ZBLOCK - zs->gz.avail_out;
+			if (fin) {
+				more = r != Z_STREAM_END;
+			} else {
+				more = zs->gz.avail_in > 0;
+			}
+			if (zs->inlen == COB_ZBLOCK
+			 || (fin && !more)) {
+				if (cob_zs_put (zs))
+					return -1;
+			}
+		}
+	}
+#endif
+#if defined (HAVE_ZSTD)
+	if (zs->type == COB_COMPRESS_ZSTD) {
+		ZSTD_inBuffer	ib;
+		ZSTD_outBuffer	ob;
+		size_t		r;
+		ib.src = data;
+		ib.size = len;
+		ib.pos = 0;
+		while (more) {
+			ob.dst = zs->in;
+			ob.size = COB_ZBLOCK;
+			ob.pos = zs->inlen;
+			if (fin) {
+				r = ZSTD_endStream (zs->zc, &ob);
+			} else {
+				r = ZSTD_compressStream (zs->zc, &ob, &ib);
+			}
+			if (ZSTD_isError (r)) {
+				zs->err = 1;
+				return -1;
+			}
+			zs->inlen = ob.pos;
+			if (fin) {
+				more = r > 0;
+			} else {
+				more = ib.pos < ib.size;
+			}
+			if (zs->inlen == COB_ZBLOCK
+			 || (fin && !more)) {
+				if (cob_zs_put (zs))
+					return -1;
+			}
+		}
+	}
+#endif
+	if (fin) {
+		zs->ended = 1;
+	} else {
+		zs->wbase += len;
+	}
+	return 0;
+}
+
+/*
+ * Add decompressed data to the window
+ * Returns the number of bytes added, 0 at End-of-File and -1 on error
+ */
+static int
+cob_zs_inflate (struct cob_zstream *zs)
+{
+	size_t	drop, got = 0;
+	int	n;
+
+	if (zs->wlen == zs->wsize) {		/* Slide window */
+		drop = zs->wlen - zs->keep;
+		memmove (zs->win, zs->win + drop, zs->keep);
+		zs->wbase += drop;
+		zs->wlen -= drop;
+		zs->wpos -= drop;
+	}
+	while (got == 0) {
+		if (zs->err)
+			return -1;
+		if (zs->inpos == zs->inlen) {
+			if (zs->eof) {
+				if (!zs->ended) {	/* Truncated file */
+					zs->err = 1;
+					return -1;
+				}
+				return 0;
+			}
+			n = (int)read (zs->fd, zs->in, COB_ZBLOCK);
+			if (n < 0) {
+				zs->err = 1;
+				return -1;
+			}
+			if (n == 0) {
+				zs->eof = 1;
+				continue;
+			}
+			zs->inlen = n;
+			zs->inpos = 0;
+		}
+#if defined (HAVE_ZLIB)
+		if (zs->type == COB_COMPRESS_GZIP) {
+			int	r;
+			if (zs->ended) {		/* Next member of the file */
+				(void)inflateReset (&zs->gz);
+				zs->ended = 0;
+			}
+			zs->gz.next_in = zs->in + zs->inpos;
+			zs->gz.avail_in = (uInt)(zs->inlen - zs->inpos);
+			zs->gz.next_out = zs->win + zs->wlen;
+			zs->gz.avail_out = (uInt)(zs->wsize - zs->wlen);
+			r = inflate (&zs->gz, Z_NO_FLUSH);
+			if (r == Z_STREAM_END) {
+				zs->ended = 1;
+			} else if (r != Z_OK
+				&& r != Z_BUF_ERROR) {
+				zs->err = 1;
+				return -1;
+			}
+			zs->inpos = zs->inlen - zs->gz.avail_in;
+			got = (zs->wsize - zs->wlen) - zs->gz.avail_out;
+		}
+#endif
+#if defined (HAVE_ZSTD)
+		if (zs->type == COB_COMPRESS_ZSTD) {
+			ZSTD_inBuffer	ib;
+			ZSTD_outBuffer	ob;
+			size_t		r;
+			ib.src = zs->in;
+			ib.size = zs->inlen;
+			ib.pos = zs->inpos;
+			ob.dst = zs->win;
+			ob.size = zs->wsize;
+			ob.pos = zs->wlen;
+			r = ZSTD_decompressStream (zs->zd, &ob, &ib);
+			if (ZSTD_isError (r)) {
+				zs->err = 1;
+				return -1;
+			}
+			zs->ended = r == 0;
+			zs->inpos = ib.pos;
+			got = ob.pos - zs->wlen;
+		}
+#endif
+		zs->wlen += got;
+	}
+	return (int)got;
+}
+
+/* Same as 'read' on the decompressed data */
+static int
+cob_zs_read (struct cob_zstream *zs, void *data, size_t len)
+{
+	unsigned char	*p = data;
+	size_t		n, done = 0;
+
+	while (done < len) {
+		if (zs->wpos == zs->wlen
+		 && cob_zs_inflate (zs) <= 0)
+			break;
+		n = zs->wlen - zs->wpos;
+		if (n > len - done)
+			n = len - done;
+		memcpy (p + done, zs->win + zs->wpos, n);
+		zs->wpos += n;
+		done += n;
+	}
+	if (done == 0
+	 && zs->err)
+		return -1;
+	return (int)done;
+}
+
+static int
+cob_zs_write (struct cob_zstream *zs, const void *data, size_t len)
+{
+	if (cob_zs_deflate (zs, data, len, 0))
+		return -1;
+	return (int)len;
+}
+
+/*
+ * Position the decompressed data, pos == -1 means End-of-File
+ * Reading: anywhere from the start of the window forward
+ * Writing: only the current position (which is the end)
+ */
+static off_t
+cob_zs_seek (struct cob_zstream *zs, off_t pos)
+{
+	if (zs->wrt) {
+		if (pos == -1
+		 || pos == zs->wbase)
+			return zs->wbase;
+		return -1;
+	}
+	if (pos < zs->wbase)
+		return -1;
+	while (pos > zs->wbase + (off_t)zs->wlen) {
+		zs->wpos = zs->wlen;
+		if (cob_zs_inflate (zs) <= 0)
+			return -1;
+	}
+	zs->wpos = (size_t)(pos - zs->wbase);
+	return pos;
+}
+
+/* Finish the compressed stream */
+static int
+cob_zs_end (struct cob_zstream *zs)
+{
+	if (zs->wrt
+	 && !zs->ended) {
+		return cob_zs_deflate (zs, NULL, 0, 1);
+	}
+	return zs->err ? -1 : 0;
+}
+
+static ssize_t
+cob_zs_cookie_read (void *cookie, char *buf, size_t size)
+{
+	return (ssize_t)cob_zs_read (cookie, buf, size);
+}
+
+static ssize_t
+cob_zs_cookie_write (void *cookie, const char *buf, size_t size)
+{
+	if (cob_zs_write (cookie, buf, size) < 0)
+		return 0;
+	return (ssize_t)size;
+}
+
+static int
+cob_zs_cookie_seek (void *cookie, off64_t *offset, int whence)
+{
+	struct cob_zstream	*zs = cookie;
+	off_t		pos;
+
+	switch (whence) {
+	case SEEK_SET:
+		pos = (off_t)*offset;
+		break;
+	case SEEK_CUR:
+		pos = cob_zs_tell (zs) + (off_t)*offset;
+		break;
+	default:
+		pos = -1;
+		break;
+	}
+	pos = cob_zs_seek (zs, pos);
+	if (pos == -1) {
+		errno = EINVAL;
+		return -1;
+	}
+	*offset = (off64_t)pos;
+	return 0;
+}
+
+static int
+cob_zs_cookie_close (void *cookie)
+{
+	struct cob_zstream	*zs = cookie;
+	int		ret;
+
+	ret = cob_zs_end (zs);
+	if (zs->raw)
+		fclose (zs->raw);
+	cob_zs_free (zs);
+	return ret;
+}
+
+static cookie_io_functions_t cob_zs_funcs = {
+	cob_zs_cookie_read,
+	cob_zs_cookie_write,
+	cob_zs_cookie_seek,
+	cob_zs_cookie_close
+};
+#endif
+
+/*
+ * Return the compression to be used for the file,
+ * COB_COMPRESS_AUTO takes it from the file name suffix
+ */
+static int
+cob_zs_type (cob_file *f, const char *filename)
+{
+	size_t	len;
+
+	if (f->organization != COB_ORG_SEQUENTIAL
+	 && f->organization != COB_ORG_LINE_SEQUENTIAL)
+		return COB_COMPRESS_NONE;
+	if (f->compress != COB_COMPRESS_AUTO)
+		return f->compress;
+	len = strlen (filename);
+	if (len > 3
+	 && strcasecmp (filename + len - 3, ".gz") == 0)
+		return COB_COMPRESS_GZIP;
+	if (len > 4
+	 && strcasecmp (filename + len - 4, ".zst") == 0)
+		return COB_COMPRESS_ZSTD;
+	return COB_COMPRESS_NONE;
+}
+
+/* Check that the compression can be used for the OPEN mode */
+static int
+cob_zs_check (int type, const int mode)
+{
+	if (type == COB_COMPRESS_NONE)
+		return 0;
+#if !defined (HAVE_ZLIB) || !defined (COB_USE_COMPRESS)
+	if (type == COB_COMPRESS_GZIP)
+		return COB_STATUS_91_NOT_AVAILABLE;
+#endif
+#if !defined (HAVE_ZSTD) || !defined (COB_USE_COMPRESS)
+	if (type == COB_COMPRESS_ZSTD)
+		return COB_STATUS_91_NOT_AVAILABLE;
+#endif
+	if (mode == COB_OPEN_I_O)		/* No REWRITE of compressed data */
+		return COB_STATUS_37_PERMISSION_DENIED;
+	return 0;
+}
+
+/*
+ * Put the codec on the opened file,
+ * if that fails the file is closed
+ */
+static int
+cob_zs_attach (cob_file *f, int type)
+{
+#if defined (COB_USE_COMPRESS)
+	struct cob_zstream	*zs;
+	FILE		*fp;
+	int		wrt;
+
+	if (type == COB_COMPRESS_NONE)
+		return 0;
+	wrt = f->open_mode != COB_OPEN_INPUT;
+	zs = cob_zs_new (type, f->fd, wrt, (size_t)f->record_max * 2);
+	fp = NULL;
+	if (!zs->err) {
+		fp = fopencookie (zs, wrt ? "w" : "r", cob_zs_funcs);
+	}
+	if (fp == NULL) {
+		cob_zs_free (zs);
+		if (f->file) {
+			fclose ((FILE *)f->file);
+		} else {
+			close (f->fd);
+		}
+		f->file = NULL;
+		f->fd = -1;
+		return COB_STATUS_30_PERMANENT_ERROR;
+	}
+	if (f->organization == COB_ORG_SEQUENTIAL) {
+		/* Records go via 'fd' and ADVANCING via 'FILE *', both into the codec */
+		setvbuf (fp, NULL, _IONBF, 0);
+	}
+	zs->raw = f->file;
+	f->file = fp;
+	f->zstream = zs;
+	return 0;
+#else
+	COB_UNUSED (f);
+	COB_UNUSED (type);
+	return 0;
+#endif
+}
+
+/* Read, write and position of the file data, through the codec if any */
+static int
+cob_sys_read (cob_file *f, void *data, size_t len)
+{
+#if defined (COB_USE_COMPRESS)
+	if (f->zstream)
+		return cob_zs_read (f->zstream, data, len);
+#endif
+	return (int)read (f->fd, data, len);
+}
+
+static int
+cob_sys_write (cob_file *f, const void *data, size_t len)
+{
+#if defined (COB_USE_COMPRESS)
+	if (f->zstream)
+		return cob_zs_write (f->zstream, data, len);
+#endif
+	return (int)write (f->fd, data, len);
+}
+
+static off_t
+cob_sys_tell (cob_file *f)
+{
+#if defined (COB_USE_COMPRESS)
+	if (f->zstream)
+		return cob_zs_tell (f->zstream);
+#endif
+	return lseek (f->fd, 0, SEEK_CUR);
+}
+
 /* 
  * Set file position. pos == -1 means End-of-File
  * You must set the position for both 'fd' and 'file' 
@@ -404,6 +1059,19 @@ set_file_pos (cob_file *f, off_t pos)
 	off_t  newpos = -1;
 	if (io_rtns[f->io_routine].dbase)
 		return 0;
+#if defined (COB_USE_COMPRESS)
+	if (f->zstream) {		/* Position in the decompressed data */
+		if (f->organization == COB_ORG_LINE_SEQUENTIAL) {
+			if (pos == -1) {
+				fseek ((FILE*)f->file, 0, SEEK_END);
+			} else {
+				fseek ((FILE*)f->file, pos, SEEK_SET);
+			}
+			return ftell ((FILE*)f->file);
+		}
+		return cob_zs_seek (f->zstream, pos);
+	}
+#endif
 	if(f->organization == COB_ORG_LINE_SEQUENTIAL) {	/* Uses 'f->file' */
 		if (pos == -1) {	/* Seek to end of file */
 			if (f->fd > 0) {
@@ -444,44 +1112,607 @@ set_file_pos (cob_file *f, off_t pos)
 	return newpos;
 }
 
-/* file_format: see COB_FILE_IS_xx */
-static const char *file_format[12] = {"0","1","2","3","B32","B64","L32","L64","?","?","gc","mf"};
-static const char *dict_ext = "dd";
-
-#if defined(WITH_INDEXED)
-static const char ix_routine = WITH_INDEXED;
-#else
-#if defined(WITH_CISAM)
-static const char ix_routine = COB_IO_CISAM;
-#elif defined(WITH_DISAM)
-static const char ix_routine = COB_IO_DISAM;
-#elif defined(WITH_VISAM)
-static const char ix_routine = COB_IO_VISAM;
-#elif defined(WITH_VBISAM)
-static const char ix_routine = COB_IO_VBISAM;
-#elif defined(WITH_DB)
-static const char ix_routine = COB_IO_BDB;
-#elif defined(WITH_LMDB)
-static const char ix_routine = COB_IO_LMDB;
-#elif defined(WITH_ODBC)
-static const char ix_routine = COB_IO_ODBC;
-#elif defined(WITH_OCI)
-static const char ix_routine = COB_IO_OCI;
-#elif	WITH_INDEX_EXTFH
-static const char ix_routine = COB_IO_IXEXT;
-#else
-static const char ix_routine = COB_IO_IXEXT;
-#endif
-#endif
-static const cob_field_attr alnum_attr = {COB_TYPE_ALPHANUMERIC, 0, 0, 0, NULL};
-
 /*
- * Copy ISAM file info as documented in C-ISAM manual
+ * Buffered I/O for (record) SEQUENTIAL and RELATIVE files
+ * While reading, 'fd' is positioned at 'off + len'
+ * While writing, 'fd' is positioned at 'off' and data[0..len] is pending
+ * In both cases the logical file position is 'off + pos'
+ * With 'map' set 'data' is the complete file mapped into memory,
+ * 'off' is 0 and 'fd' is not used for reading at all
  */
+struct cob_iobuf {
+	unsigned char	*data;		/* Buffer area */
+	size_t		size;		/* Allocated size of 'data' */
+	size_t		len;		/* Bytes of valid data in buffer */
+	size_t		pos;		/* Next byte to be returned from buffer */
+	off_t		off;		/* File position of data[0], -1 = take from 'fd' */
+	int		wrt;		/* Buffer holds data not yet written */
+	int		map;		/* 'data' is mmap'ed file */
+	int		err;		/* errno of a failed flush, kept until CLOSE */
+};
+
 static void
-isam_to_file (FILE *fdin, cob_file *f, unsigned char *hbuf)
+cob_iobuf_alloc (cob_file *f, size_t size)
 {
-	unsigned char ibuf[4096], *p, *pp, cmprs;
+	struct cob_iobuf	*b;
+
+	if (size == 0
+	 || f->iobuf != NULL)
+		return;
+	b = cob_malloc (sizeof (struct cob_iobuf));
+	b->data = cob_malloc (size);
+	b->size = size;
+	b->off = -1;
+	f->iobuf = b;
+}
+
+static void
+cob_iobuf_free (cob_file *f)
+{
+	struct cob_iobuf	*b = f->iobuf;
+
+	if (b == NULL)
+		return;
+#if defined (COB_USE_MMAP)
+	if (b->map) {
+		munmap ((void *)b->data, b->size);
+	} else
+#endif
+	cob_free (b->data);
+	cob_free (b);
+	f->iobuf = NULL;
+}
+
+/*
+ * Map a file opened INPUT into memory, records are then copied
+ * directly from the mapping without any read() or lseek()
+ */
+static void
+cob_iobuf_map (cob_file *f)
+{
+#if defined (COB_USE_MMAP)
+	struct cob_iobuf	*b;
+	struct stat	st;
+	void		*addr;
+
+	if (f->iobuf != NULL
+	 || fstat (f->fd, &st) != 0
+	 || st.st_size <= 0
+	 || (cob_u64_t)st.st_size > (cob_u64_t)(size_t)-1)
+		return;
+	addr = mmap (NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, f->fd, 0);
+	if (addr == MAP_FAILED)
+		return;
+#if defined (HAVE_MADVISE)
+	if (f->access_mode == COB_ACCESS_SEQUENTIAL) {
+		(void)madvise (addr, (size_t)st.st_size, MADV_SEQUENTIAL);
+	} else if (f->access_mode == COB_ACCESS_RANDOM) {
+		(void)madvise (addr, (size_t)st.st_size, MADV_RANDOM);
+	}
+#endif
+	b = cob_malloc (sizeof (struct cob_iobuf));
+	b->data = addr;
+	b->size = b->len = (size_t)st.st_size;
+	b->pos = (size_t)lseek (f->fd, 0, SEEK_CUR);
+	b->off = 0;
+	b->map = 1;
+	f->iobuf = b;
+#else
+	COB_UNUSED (f);
+#endif
+}
+
+/* Check if the file data is taken from a mapping */
+static int
+cob_iobuf_mapped (cob_file *f)
+{
+	return f->iobuf != NULL
+	    && ((struct cob_iobuf *)f->iobuf)->map;
+}
+
+/*
+ * Write out pending data of the write-behind buffer
+ * On error the pending data is dropped and -1 returned;
+ * the error is remembered so that every later flush, READ, WRITE
+ * and the CLOSE fail, even if the first failure was not reported
+ */
+static int
+cob_iobuf_flush (cob_file *f)
+{
+	struct cob_iobuf	*b = f->iobuf;
+	size_t		done = 0;
+	int		wr;
+
+	if (b == NULL)
+		return 0;
+	if (b->err) {
+		errno = b->err;
+		return -1;
+	}
+	if (!b->wrt)
+		return 0;
+	b->wrt = 0;
+	while (done < b->len) {
+		wr = cob_sys_write (f, b->data + done, b->len - done);
+		if (wr <= 0) {
+			b->err = (wr < 0 && errno) ? errno : EIO;
+			b->len = b->pos = 0;
+			b->off = -1;
+			errno = b->err;
+			return -1;
+		}
+		done += wr;
+	}
+	b->off += b->len;
+	b->len = b->pos = 0;
+	return 0;
+}
+
+/*
+ * Discard buffered data; 'fd' must be positioned at 'pos'
+ * pos == -1 means get the position from 'fd' when next needed
+ */
+static void
+cob_iobuf_reset (cob_file *f, off_t pos)
+{
+	struct cob_iobuf	*b = f->iobuf;
+
+	if (b == NULL)
+		return;
+	if (b->map) {
+		if (pos != -1)
+			b->pos = (size_t)pos;
+		return;
+	}
+	(void)cob_iobuf_flush (f);	/* Error is kept in 'err' */
+	b->len = b->pos = 0;
+	b->off = pos;
+}
+
+/* Return logical file position */
+static off_t
+cob_iobuf_tell (cob_file *f)
+{
+	struct cob_iobuf	*b = f->iobuf;
+
+	if (b == NULL)
+		return cob_sys_tell (f);
+	if (b->off == -1) {
+		b->off = cob_sys_tell (f);
+		b->len = b->pos = 0;
+	}
+	return b->off + (off_t)b->pos;
+}
+
+/*
+ * Same as 'read' but data is taken from the I/O buffer,
+ * which is refilled a block at a time
+ */
+static int
+cob_iobuf_read (cob_file *f, void *data, size_t len)
+{
+	struct cob_iobuf	*b = f->iobuf;
+	unsigned char	*p = data;
+	size_t		n, done = 0;
+	int		rd = 0;
+
+	if (b == NULL)
+		return cob_sys_read (f, data, len);
+	if (b->map) {
+		if (b->pos >= b->len)
+			return 0;
+		if (len > b->len - b->pos)
+			len = b->len - b->pos;
+		memcpy (data, b->data + b->pos, len);
+		b->pos += len;
+		return (int)len;
+	}
+	if (cob_iobuf_flush (f))
+		return -1;
+	(void)cob_iobuf_tell (f);
+	while (done < len) {
+		if (b->pos >= b->len) {
+			b->off += b->len;
+			b->len = b->pos = 0;
+			if (len - done >= b->size) {	/* Large request: bypass buffer */
+				rd = cob_sys_read (f, p + done, len - done);
+				if (rd <= 0)
+					break;
+				b->off += rd;
+				done += rd;
+				continue;
+			}
+			rd = cob_sys_read (f, b->data, b->size);
+			if (rd <= 0)
+				break;
+			b->len = rd;
+		}
+		n = b->len - b->pos;
+		if (n > len - done)
+			n = len - done;
+		memcpy (p + done, b->data + b->pos, n);
+		b->pos += n;
+		done += n;
+	}
+	if (done == 0
+	 && rd < 0)
+		return -1;
+	return (int)done;
+}
+
+/*
+ * Same as 'write' but data is collected in the I/O buffer
+ * and written out when the buffer is full
+ */
+static int
+cob_iobuf_write (cob_file *f, const void *data, size_t len)
+{
+	struct cob_iobuf	*b = f->iobuf;
+
+	if (b == NULL)
+		return cob_sys_write (f, data, len);
+	if (b->err) {			/* Earlier flush failed */
+		errno = b->err;
+		return -1;
+	}
+	(void)cob_iobuf_tell (f);
+	if (!b->wrt
+	 && b->len > 0) {		/* Drop read-ahead data */
+		if (b->pos != b->len
+		 && lseek (f->fd, b->off + (off_t)b->pos, SEEK_SET) == -1)
+			return -1;
+		b->off += b->pos;
+		b->len = b->pos = 0;
+	}
+	if (b->len + len > b->size) {
+		if (cob_iobuf_flush (f))
+			return -1;
+		if (len >= b->size) {		/* Large request: bypass buffer */
+			len = cob_sys_write (f, data, len);
+			if ((int)len > 0)
+				b->off += len;
+			return (int)len;
+		}
+	}
+	memcpy (b->data + b->len, data, len);
+	b->len += len;
+	b->pos = b->len;
+	b->wrt = 1;
+	return (int)len;
+}
+
+/*
+ * Asynchronous prefetch for SEQUENTIAL and LINE SEQUENTIAL files opened INPUT
+ * A helper thread reads the file up to 'size' bytes ahead of the position
+ * of the program, so the data is in the system cache when it is needed;
+ * the thread uses pread() only, the position of 'fd' is not changed;
+ * for concatenated input the thread goes on with the start of the next
+ * member when it reaches End-of-File of the current one
+ */
+#if defined (COB_USE_PREFETCH)
+struct cob_prefetch {
+	pthread_t	thread;
+	pthread_mutex_t	lock;
+	pthread_cond_t	cond;
+	int		fd;
+	int		nextfd;		/* Next member of concatenated input, or -1 */
+	int		stop;		/* Thread should terminate */
+	int		eof;		/* Thread reached End-of-File */
+	off_t		want;		/* Position of the program */
+	off_t		done;		/* File data has been read up to here */
+	off_t		nextdone;	/* Next member has been read up to here */
+	size_t		size;		/* Distance to stay ahead */
+	size_t		blk;		/* Size of one read */
+	unsigned char	*data;		/* Read area of the thread */
+};
+
+static void *
+cob_prefetch_thread (void *arg)
+{
+	struct cob_prefetch	*p = arg;
+	off_t		from;
+	ssize_t		n;
+
+	pthread_mutex_lock (&p->lock);
+	for (;;) {
+		while (!p->stop
+		 && (p->eof
+		  ? (p->nextfd < 0
+		   || p->nextdone >= (off_t)p->size)
+		  : p->done >= p->want + (off_t)p->size)) {
+			pthread_cond_wait (&p->cond, &p->lock);
+		}
+		if (p->stop)
+			break;
+		if (p->eof) {			/* Start of the next member */
+			from = p->nextdone;
+			pthread_mutex_unlock (&p->lock);
+			n = pread (p->nextfd, p->data, p->blk, from);
+			pthread_mutex_lock (&p->lock);
+			if (n <= 0) {
+				p->nextdone = (off_t)p->size;
+			} else {
+				p->nextdone = from + n;
+			}
+			continue;
+		}
+		if (p->done < p->want)
+			p->done = p->want;
+		from = p->done;
+		pthread_mutex_unlock (&p->lock);
+		n = pread (p->fd, p->data, p->blk, from);
+		pthread_mutex_lock (&p->lock);
+		if (n <= 0) {
+			p->eof = 1;
+		} else if (p->done == from) {	/* Not repositioned meanwhile */
+			p->done = from + n;
+		}
+	}
+	pthread_mutex_unlock (&p->lock);
+	return NULL;
+}
+#endif
+
+static void
+cob_prefetch_start (cob_file *f)
+{
+#if defined (COB_USE_PREFETCH)
+	struct cob_prefetch	*p;
+
+	if (f->prefetch_size == 0
+	 || f->prefetch != NULL
+	 || f->fd < 0
+	 || f->flag_is_pipe
+	 || f->flag_is_std
+	 || f->zstream != NULL
+	 || cob_iobuf_mapped (f))
+		return;
+	p = cob_malloc (sizeof (struct cob_prefetch));
+	p->fd = f->fd;
+	p->size = f->prefetch_size;
+	p->blk = p->size / 4;
+	if (p->blk < 4096)
+		p->blk = 4096;
+	p->data = cob_malloc (p->blk);
+	p->want = p->done = lseek (f->fd, 0, SEEK_CUR);
+	p->nextfd = -1;
+	pthread_mutex_init (&p->lock, NULL);
+	pthread_cond_init (&p->cond, NULL);
+	if (pthread_create (&p->thread, NULL, cob_prefetch_thread, p) != 0) {
+		pthread_cond_destroy (&p->cond);
+		pthread_mutex_destroy (&p->lock);
+		cob_free (p->data);
+		cob_free (p);
+		return;
+	}
+	f->prefetch = p;
+#else
+	COB_UNUSED (f);
+#endif
+}
+
+/* Terminate the prefetch thread, must be done before 'fd' is closed */
+static void
+cob_prefetch_stop (cob_file *f)
+{
+#if defined (COB_USE_PREFETCH)
+	struct cob_prefetch	*p = f->prefetch;
+
+	if (p == NULL)
+		return;
+	pthread_mutex_lock (&p->lock);
+	p->stop = 1;
+	pthread_cond_signal (&p->cond);
+	pthread_mutex_unlock (&p->lock);
+	pthread_join (p->thread, NULL);
+	pthread_cond_destroy (&p->cond);
+	pthread_mutex_destroy (&p->lock);
+	cob_free (p->data);
+	cob_free (p);
+	f->prefetch = NULL;
+#else
+	COB_UNUSED (f);
+#endif
+}
+
+/* Tell the prefetch thread about the next member of concatenated input */
+static int
+cob_prefetch_follow (cob_file *f, int fd)
+{
+#if defined (COB_USE_PREFETCH)
+	struct cob_prefetch	*p = f->prefetch;
+
+	if (p == NULL)
+		return 0;
+	pthread_mutex_lock (&p->lock);
+	p->nextfd = fd;
+	p->nextdone = 0;
+	pthread_cond_signal (&p->cond);
+	pthread_mutex_unlock (&p->lock);
+	return 1;
+#else
+	COB_UNUSED (f);
+	COB_UNUSED (fd);
+	return 0;
+#endif
+}
+
+/*
+ * Tell the prefetch thread the current position of the program;
+ * the thread is only woken up after a block has been used
+ */
+static void
+cob_prefetch_note (cob_file *f, off_t pos)
+{
+#if defined (COB_USE_PREFETCH)
+	struct cob_prefetch	*p = f->prefetch;
+
+	if (p == NULL
+	 || pos < 0
+	 || (pos >= p->want
+	  && pos < p->want + (off_t)p->blk))
+		return;
+	pthread_mutex_lock (&p->lock);
+	if (pos < p->want) {		/* Moved back: start again from there */
+		p->done = pos;
+		p->eof = 0;
+	}
+	p->want = pos;
+	pthread_cond_signal (&p->cond);
+	pthread_mutex_unlock (&p->lock);
+#else
+	COB_UNUSED (f);
+	COB_UNUSED (pos);
+#endif
+}
+
+/*
+ * Concatenated input (COB_SEQ_CONCAT_NAME)
+ * The list of member files is split and their sizes are taken at OPEN;
+ * while one member is read the next one is already opened and the start
+ * of it is read ahead, by the prefetch thread if there is one,
+ * otherwise by the system via posix_fadvise
+ */
+#define COB_CONCAT_AHEAD	(256 * 1024)	/* Minimum read ahead of next member */
+
+struct cob_concat {
+	int		count;		/* Number of members */
+	int		cur;		/* Member currently read */
+	int		nextfd;		/* Next member opened ahead, -1 = not yet */
+	char		**name;		/* Member file names, in 'f->org_filename' */
+	cob_s64_t	*size;		/* Member file sizes */
+	cob_s64_t	total;		/* Size of all members */
+	cob_s64_t	done;		/* Size of the members already read */
+};
+
+static void
+cob_concat_free (cob_file *f)
+{
+	struct cob_concat	*cc = f->concat;
+
+	if (cc != NULL) {
+		if (cc->nextfd >= 0)
+			close (cc->nextfd);
+		cob_free (cc->name);
+		cob_free (cc->size);
+		cob_free (cc);
+		f->concat = NULL;
+	}
+	if (f->org_filename) {
+		cob_cache_free (f->org_filename);
+		f->org_filename = NULL;
+	}
+	f->nxt_filename = NULL;
+}
+
+/*
+ * Split the list of file names at the separator,
+ * returns the name of the first member
+ * (the list is copied, 'names' may be file_open_name)
+ */
+static char *
+cob_concat_init (cob_file *f, const char *names)
+{
+	struct cob_concat	*cc;
+	struct stat	st;
+	char		*p;
+	int		k;
+
+	cob_concat_free (f);
+	f->org_filename = cob_strdup (names);
+	cc = cob_malloc (sizeof (struct cob_concat));
+	cc->count = 1;
+	for (p = f->org_filename; *p != 0; p++) {
+		if (*p == file_setptr->cob_concat_sep[0])
+			cc->count++;
+	}
+	cc->name = cob_malloc (sizeof (char *) * cc->count);
+	cc->size = cob_malloc (sizeof (cob_s64_t) * cc->count);
+	cc->nextfd = -1;
+	cc->name[0] = f->org_filename;
+	for (k = 1, p = f->org_filename; *p != 0; p++) {
+		if (*p == file_setptr->cob_concat_sep[0]) {
+			*p = 0;
+			cc->name[k++] = p + 1;
+		}
+	}
+	for (k = 0; k < cc->count; k++) {
+		if (stat (cc->name[k], &st) == 0
+		 && S_ISREG (st.st_mode)) {
+			cc->size[k] = (cob_s64_t)st.st_size;
+			cc->total += cc->size[k];
+		}
+	}
+	f->concat = cc;
+	f->nxt_filename = cc->count > 1 ? cc->name[1] : NULL;
+	return cc->name[0];
+}
+
+/* Open the next member ahead of time and start reading it */
+static void
+cob_concat_ahead (cob_file *f)
+{
+	struct cob_concat	*cc = f->concat;
+
+	if (cc == NULL
+	 || cc->nextfd >= 0
+	 || cc->cur + 1 >= cc->count)
+		return;
+	if (f->open_mode == COB_OPEN_I_O) {
+		cc->nextfd = open (cc->name[cc->cur + 1], O_RDWR);
+	} else {
+		cc->nextfd = open (cc->name[cc->cur + 1], O_RDONLY);
+	}
+	if (cc->nextfd < 0)
+		return;
+	if (!cob_prefetch_follow (f, cc->nextfd)) {
+#if defined (HAVE_POSIX_FADVISE) && defined (POSIX_FADV_WILLNEED)
+		size_t	ahead = f->iobuf_size;
+		if (ahead < COB_CONCAT_AHEAD)
+			ahead = COB_CONCAT_AHEAD;
+		(void)posix_fadvise (cc->nextfd, 0, (off_t)ahead, POSIX_FADV_WILLNEED);
+#endif
+	}
+}
+
+/* file_format: see COB_FILE_IS_xx */
+static const char *file_format[12] = {"0","1","2","3","B32","B64","L32","L64","?","?","gc","mf"};
+static const char *dict_ext = "dd";
+
+#if defined(WITH_INDEXED)
+static const char ix_routine = WITH_INDEXED;
+#else
+#if defined(WITH_CISAM)
+static const char ix_routine = COB_IO_CISAM;
+#elif defined(WITH_DISAM)
+static const char ix_routine = COB_IO_DISAM;
+#elif defined(WITH_VISAM)
+static const char ix_routine = COB_IO_VISAM;
+#elif defined(WITH_VBISAM)
+static const char ix_routine = COB_IO_VBISAM;
+#elif defined(WITH_DB)
+static const char ix_routine = COB_IO_BDB;
+#elif defined(WITH_LMDB)
+static const char ix_routine = COB_IO_LMDB;
+#elif defined(WITH_ODBC)
+static const char ix_routine = COB_IO_ODBC;
+#elif defined(WITH_OCI)
+static const char ix_routine = COB_IO_OCI;
+#elif	WITH_INDEX_EXTFH
+static const char ix_routine = COB_IO_IXEXT;
+#else
+static const char ix_routine = COB_IO_IXEXT;
+#endif
+#endif
+static const cob_field_attr alnum_attr = {COB_TYPE_ALPHANUMERIC, 0, 0, 0, NULL};
+
+/*
+ * Copy ISAM file info as documented in C-ISAM manual
+ */
+static void
+isam_to_file (FILE *fdin, cob_file *f, unsigned char *hbuf)
+{
+	unsigned char ibuf[4096], *p, *pp, cmprs;
 	int		idxblksz, idxblk, k, part, adj;
 	int		ttlen, klen, kpos, bgn, kdln, supchr;
 	idxblksz = LDCOMPX2 (hbuf+6) + 1;
@@ -682,6 +1913,35 @@ keycmp (char *keyword, const char *val)
 	return (toupper(*keyword)-toupper(*val));
 }
 
+/* Limit of the per-file buffer sizes, as for their runtime options */
+#define COB_IOBUF_MAX	(64 * 1024 * 1024)
+
+/*
+ * Return size value from option, may be followed by K, M or G;
+ * a value that does not fit into size_t returns (size_t)-1
+ */
+static size_t
+get_size_value (const char *value)
+{
+	size_t	sz = 0;
+	size_t	unit = 1;
+
+	while (isdigit ((unsigned char)*value)) {
+		if (sz > ((size_t)-1 - 9) / 10)
+			return (size_t)-1;
+		sz = sz * 10 + (*value++ - '0');
+	}
+	if (toupper ((unsigned char)*value) == 'K')
+		unit = 1024;
+	else if (toupper ((unsigned char)*value) == 'M')
+		unit = 1024 * 1024;
+	else if (toupper ((unsigned char)*value) == 'G')
+		unit = 1024 * 1024 * 1024;
+	if (sz > (size_t)-1 / unit)
+		return (size_t)-1;
+	return sz * unit;
+}
+
 /*
  * Write data file description to a string 
  */
@@ -798,6 +2058,8 @@ write_file_def (cob_file *f, char *out)
 					k += sprintf(&out[k],"sup%d=x'%02X' ",idx+1,f->keys[idx].char_suppress);
 			}
 		}
+		if (f->expect_recs > 0)
+			k += sprintf(&out[k],"records=%lu ",(unsigned long)f->expect_recs);
 		if (f->flag_read_chk_dups)
 			k += sprintf(&out[k],"dups_ahead=always ");
 		else if (f->flag_read_no_02)
@@ -1653,6 +2915,7 @@ cob_file_sync (cob_file *f)
 		return;
 	}
 	if (f->organization != COB_ORG_SORT) {
+		(void)cob_iobuf_flush (f);	/* Error is kept for next WRITE/CLOSE */
 		if (f->file) {
 			fflush ((FILE *)f->file);
 		}
@@ -1880,6 +3143,14 @@ cob_set_file_defaults (cob_file *f)
 		return;
 
 	f->trace_io = file_setptr->cob_trace_io ? 1 : 0;
+	f->iobuf_size = file_setptr->cob_seq_buffer;
+	f->wrbuf_size = file_setptr->cob_write_buffer;
+	f->flag_mmap = file_setptr->cob_file_mmap ? 1 : 0;
+	f->prefetch_size = file_setptr->cob_seq_prefetch;
+	f->flag_relmap = file_setptr->cob_rel_slotmap ? 1 : 0;
+	f->compress = (unsigned char)file_setptr->cob_file_compress;
+	f->map_size = file_setptr->cob_lmdb_mapsize;
+	f->map_max = file_setptr->cob_lmdb_maxsize;
 	f->io_stats = file_setptr->cob_stats_record ? 1 : 0;
 	f->flag_keycheck = file_setptr->cob_keycheck ? 1 : 0;
 	f->flag_do_qbl = 0;
@@ -1946,6 +3217,7 @@ cob_set_file_format (cob_file *f, char *defstr, int updt)
 {
 	int		i,j,k,settrue,ivalue,nkeys,keyn,idx;
 	unsigned int	maxrecsz = 0;
+	size_t	sz;
 	char	qt,option[64],value[COB_FILE_BUFF];
 	int ret = 0;
 
@@ -2055,6 +3327,44 @@ cob_set_file_format (cob_file *f, char *defstr, int updt)
 				f->io_stats = settrue;
 				continue;
 			}
+			if(keycmp(option,"seq_buffer") == 0) {
+				sz = settrue ? get_size_value (value) : 0;
+				if (sz <= COB_IOBUF_MAX)	/* as COB_SEQ_BUFFER */
+					f->iobuf_size = sz;
+				continue;
+			}
+			if(keycmp(option,"write_buffer") == 0) {
+				sz = settrue ? get_size_value (value) : 0;
+				if (sz <= COB_IOBUF_MAX)	/* as COB_WRITE_BUFFER */
+					f->wrbuf_size = sz;
+				continue;
+			}
+			if(strcasecmp(option,"mmap") == 0) {
+				f->flag_mmap = settrue;
+				continue;
+			}
+			if(keycmp(option,"rel_slotmap") == 0) {
+				f->flag_relmap = settrue;
+				continue;
+			}
+			if(keycmp(option,"seq_prefetch") == 0) {
+				sz = settrue ? get_size_value (value) : 0;
+				if (sz <= COB_IOBUF_MAX)	/* as COB_SEQ_PREFETCH */
+					f->prefetch_size = sz;
+				continue;
+			}
+			if(keycmp(option,"compress") == 0) {
+				if (!settrue) {
+					f->compress = COB_COMPRESS_NONE;
+				} else if (strncasecmp (value, "gz", 2) == 0) {
+					f->compress = COB_COMPRESS_GZIP;
+				} else if (strncasecmp (value, "zst", 3) == 0) {
+					f->compress = COB_COMPRESS_ZSTD;
+				} else {
+					f->compress = COB_COMPRESS_AUTO;
+				}
+				continue;
+			}
 			if(strcasecmp(option,"keycheck") == 0) {
 				f->flag_keycheck = settrue;
 				continue;
@@ -2514,6 +3824,12 @@ cob_set_file_format (cob_file *f, char *defstr, int updt)
 					
 				} else if (strcasecmp(option,"duplen") == 0) {
 					f->isam_duplen = ivalue;
+				} else if (strcasecmp(option,"records") == 0) {
+					f->expect_recs = get_size_value (value);
+				} else if (keycmp(option,"map_size") == 0) {
+					f->map_size = settrue ? get_size_value (value) : 0;
+				} else if (keycmp(option,"map_max") == 0) {
+					f->map_max = settrue ? get_size_value (value) : 0;
 				} else if (strcasecmp(option,"indexsz") == 0) {
 					if (ivalue > (16*1024))
 						ivalue = (16*1024);
@@ -3332,8 +4648,8 @@ errno_cob_sts (const int default_status)
 	}
 }
 
-#define COB_CHECKED_WRITE(fd,string,length)	do { \
-		if (write (fd, string, (size_t)length) != (size_t)length) { \
+#define COB_CHECKED_WRITE(f,string,length)	do { \
+		if (cob_sys_write (f, string, (size_t)length) != (int)length) { \
 			return errno_cob_sts (COB_STATUS_30_PERMANENT_ERROR); \
 		} \
 	} ONCE_COB /* LCOV_EXCL_LINE */
@@ -3461,10 +4777,11 @@ cob_linage_write_opt (cob_file *f, const int opt)
 }
 
 /*
- * For variable length SEQUENTIAL write the record prefix
+ * Build the record prefix for variable length SEQUENTIAL
+ * into 'buff' (at least 4 bytes)
  */
-static unsigned int
-cob_seq_write_rcsz (cob_file *f, const int rcsz)
+static void
+cob_seq_rcsz_prefix (cob_file *f, const int rcsz, unsigned char *buff)
 {
 	union {
 		unsigned char	sbuff[4];
@@ -3472,42 +4789,53 @@ cob_seq_write_rcsz (cob_file *f, const int rcsz)
 		unsigned int	sint;
 	} recsize;
 
-	if (f->record_min != f->record_max) { 
-		recsize.sint = 0;
-		switch (f->file_format) {
-		case COB_FILE_IS_GC:
-		case COB_FILE_IS_GCVS0:
-			recsize.sshort[0] = COB_MAYSWAP_16 (rcsz);
-			break;
-		case COB_FILE_IS_GCVS1:
-			recsize.sint = COB_MAYSWAP_32 (rcsz);
-			break;
-		case COB_FILE_IS_GCVS2:
-			recsize.sint = rcsz;
-			break;
-		case COB_FILE_IS_GCVS3:
-			recsize.sshort[0] = COB_MAYSWAP_16 (rcsz);
-			break;
-		case COB_FILE_IS_B32:		/* Was varseq 2 on Big Endian system */
+	recsize.sint = 0;
+	switch (f->file_format) {
+	case COB_FILE_IS_GC:
+	case COB_FILE_IS_GCVS0:
+		recsize.sshort[0] = COB_MAYSWAP_16 (rcsz);
+		break;
+	case COB_FILE_IS_GCVS1:
+		recsize.sint = COB_MAYSWAP_32 (rcsz);
+		break;
+	case COB_FILE_IS_GCVS2:
+		recsize.sint = rcsz;
+		break;
+	case COB_FILE_IS_GCVS3:
+		recsize.sshort[0] = COB_MAYSWAP_16 (rcsz);
+		break;
+	case COB_FILE_IS_B32:		/* Was varseq 2 on Big Endian system */
+		STCOMPX4(rcsz, recsize.sbuff);
+		break;
+	case COB_FILE_IS_L32:		/* Was varseq 2 on Little Endian system */
+		STBINLE4(rcsz, recsize.sbuff);
+		break;
+	case COB_FILE_IS_MF:
+		if(f->record_prefix == 2) {
+			STCOMPX2(rcsz, recsize.sbuff);
+		} else {
 			STCOMPX4(rcsz, recsize.sbuff);
-			break;
-		case COB_FILE_IS_L32:		/* Was varseq 2 on Little Endian system */
-			STBINLE4(rcsz, recsize.sbuff);
-			break;
-		case COB_FILE_IS_MF:
-			if(f->record_prefix == 2) {
-				STCOMPX2(rcsz, recsize.sbuff);
-			} else {
-				STCOMPX4(rcsz, recsize.sbuff);
-			}
-			recsize.sbuff[0] |= 0x40;
-			break;
-		default:
-			recsize.sshort[0] = COB_MAYSWAP_16 (rcsz);
-			break;
 		}
+		recsize.sbuff[0] |= 0x40;
+		break;
+	default:
+		recsize.sshort[0] = COB_MAYSWAP_16 (rcsz);
+		break;
+	}
+	memcpy (buff, recsize.sbuff, 4);
+}
+
+/*
+ * For variable length SEQUENTIAL write the record prefix
+ */
+static unsigned int
+cob_seq_write_rcsz (cob_file *f, const int rcsz)
+{
+	unsigned char	pfx[4];
 
-		if (write (f->fd, recsize.sbuff, f->record_prefix) !=
+	if (f->record_min != f->record_max) { 
+		cob_seq_rcsz_prefix (f, rcsz, pfx);
+		if (cob_iobuf_write (f, pfx, f->record_prefix) !=
 			     (int)f->record_prefix) {
 			return COB_STATUS_30_PERMANENT_ERROR;
 		}
@@ -3532,7 +4860,7 @@ cob_seq_write_opt (cob_file *f, const int opt)
 			cob_seq_write_rcsz (f, f->record_max);
 			tmp = cob_malloc (f->record_max);
 			while(i-- > 0) {
-				COB_CHECKED_WRITE (f->fd, tmp, f->record_max);
+				COB_CHECKED_WRITE (f, tmp, f->record_max);
 			}
 			cob_free (tmp);
 		}
@@ -3733,6 +5061,7 @@ cob_fd_file_open (cob_file *f, char *filename, const int mode, const int sharing
 	int		fperms;
 	unsigned int	nonexistent;
 	int		ret;
+	int		ztype;
 	COB_UNUSED(sharing);
 
 	/* Note filename points to file_open_name */
@@ -3783,6 +5112,10 @@ cob_fd_file_open (cob_file *f, char *filename, const int mode, const int sharing
 		}
 	}
 
+	ztype = cob_zs_type (f, filename);
+	if ((ret = cob_zs_check (ztype, mode)) != 0)
+		return ret;
+
 	fdmode = O_BINARY;
 	fperms = 0;
 	f->fd = -1;
@@ -3914,6 +5247,33 @@ cob_fd_file_open (cob_file *f, char *filename, const int mode, const int sharing
 
 	if ((ret=set_file_lock(f, filename, mode)) != 0)
 		return ret;
+	if ((ret = cob_zs_attach (f, ztype)) != 0)
+		return ret;
+	/* Only map when the read lock keeps other programs from writing,
+	   a file truncated while mapped would raise SIGBUS */
+	if (f->flag_mmap
+	 && f->zstream == NULL
+	 && mode == COB_OPEN_INPUT
+	 && !(f->share_mode & COB_SHARE_ALL_OTHER)
+	 && memcmp (filename, "/dev/", (size_t)5) != 0
+	 && (f->organization == COB_ORG_SEQUENTIAL
+	  || f->organization == COB_ORG_RELATIVE)) {
+		cob_iobuf_map (f);
+	}
+	if (f->organization == COB_ORG_SEQUENTIAL
+	 && (mode == COB_OPEN_INPUT || mode == COB_OPEN_I_O)) {
+		cob_iobuf_alloc (f, f->iobuf_size);
+		if (mode == COB_OPEN_INPUT) {
+			cob_prefetch_start (f);
+		}
+	} else
+	if ((f->organization == COB_ORG_SEQUENTIAL
+	  || (f->organization == COB_ORG_RELATIVE
+	   && f->access_mode == COB_ACCESS_SEQUENTIAL))
+	 && (mode == COB_OPEN_OUTPUT || mode == COB_OPEN_EXTEND)
+	 && !(f->file_features & COB_FILE_SYNC)) {	/* SYNC would flush each WRITE */
+		cob_iobuf_alloc (f, f->wrbuf_size);
+	}
 	if (f->flag_optional && nonexistent) {
 		return COB_STATUS_05_SUCCESS_OPTIONAL;
 	}
@@ -3928,6 +5288,7 @@ cob_file_open (cob_file_api *a, cob_file *f, char *filename, const int mode, con
 	/* cob_chk_file_mapping manipulates file_open_name directly */
 
 	int		ret;
+	int		ztype;
 	struct stat st;
 	FILE			*fp;
 	const char		*fmode;
@@ -4247,6 +5608,22 @@ cob_file_open (cob_file_api *a, cob_file *f, char *filename, const int mode, con
 	}
 	(void)cob_set_file_format(f, file_open_io_env, 1);		/* Set file format */
 
+	if (fp) {
+		ztype = cob_zs_type (f, filename);
+		if ((ret = cob_zs_check (ztype, mode)) != 0
+		 || (ret = cob_zs_attach (f, ztype)) != 0) {
+			if (f->file) {
+				fclose ((FILE *)f->file);
+			}
+			f->file = NULL;
+			f->fd = -1;
+			return ret;
+		}
+	}
+	if (mode == COB_OPEN_INPUT
+	 && fp) {
+		cob_prefetch_start (f);
+	}
 	if (mode == COB_OPEN_EXTEND) {
 		f->record_off = set_file_pos (f, -1);
 		if(f->lock_mode == 0
@@ -4273,9 +5650,17 @@ cob_file_open (cob_file_api *a, cob_file *f, char *filename, const int mode, con
 static int
 cob_file_close (cob_file_api *a, cob_file *f, const int opt)
 {
+	int	ret = COB_STATUS_00_SUCCESS;
 	COB_UNUSED (a);
 
-	if (!f->flag_is_pipe)
+	cob_prefetch_stop (f);
+	cob_relmap_free (f);
+	if (cob_iobuf_flush (f)) {
+		/* Still close the file and free its buffers */
+		ret = errno_cob_sts (COB_STATUS_30_PERMANENT_ERROR);
+	}
+	if (!f->flag_is_pipe
+	 && f->file != NULL)			/* NULL if next member could not be opened */
 		f->record_off = ftell ((FILE *)f->file);	/* Ending file position */
 	f->flag_close_pend = 0;
 	switch (opt) {
@@ -4306,14 +5691,14 @@ cob_file_close (cob_file_api *a, cob_file *f, const int opt)
 			 && f->last_write_mode != COB_LAST_WRITE_UNKNOWN
 			 && f->flag_needs_nl) {
 				if (f->fd >= 0) {
-					COB_CHECKED_WRITE (f->fd, "\n", 1);
+					COB_CHECKED_WRITE (f, "\n", 1);
 				}
 			}
 			f->flag_needs_nl = 0;
 		} else if (f->flag_needs_nl) {
 			f->flag_needs_nl = 0;
 			if (f->fd >= 0) {
-				COB_CHECKED_WRITE (f->fd, "\n", 1);
+				COB_CHECKED_WRITE (f, "\n", 1);
 			}
 		}
 #ifdef	HAVE_FCNTL
@@ -4333,8 +5718,18 @@ cob_file_close (cob_file_api *a, cob_file *f, const int opt)
 #endif
 			}
 		}
+#endif
+#if defined (COB_USE_COMPRESS)
+		if (f->zstream) {		/* Finish the compressed data */
+			if (fflush ((FILE *)f->file)
+			 || cob_zs_end (f->zstream)) {
+				ret = COB_STATUS_30_PERMANENT_ERROR;
+			}
+		}
 #endif
 		/* Close the file */
+		cob_concat_free (f);
+		cob_iobuf_free (f);
 		if (f->organization == COB_ORG_LINE_SEQUENTIAL) {
 			if (f->flag_is_pipe) {
 				if (f->file_pid) {
@@ -4372,7 +5767,7 @@ cob_file_close (cob_file_api *a, cob_file *f, const int opt)
 				f->file = f->fileout = NULL;
 				f->fd = f->fdout = -1;
 				f->file_pid = 0;
-				return COB_STATUS_00_SUCCESS;
+				return ret;
 			}
 #ifdef _MSC_VER /* explicit only stream or fd close with this compiler */
 			if (f->file != NULL) {
@@ -4397,6 +5792,10 @@ cob_file_close (cob_file_api *a, cob_file *f, const int opt)
 			f->fd = -1;
 		}
 #endif
+		f->zstream = NULL;		/* Freed by closing its 'FILE *' */
+		if (ret != COB_STATUS_00_SUCCESS) {
+			return ret;
+		}
 		if (opt == COB_CLOSE_NO_REWIND) {
 			f->open_mode = COB_OPEN_CLOSED;
 			return COB_STATUS_07_SUCCESS_NO_UNIT;
@@ -4406,6 +5805,9 @@ cob_file_close (cob_file_api *a, cob_file *f, const int opt)
 		if (f->fd >= 0 && f->open_mode != COB_OPEN_INPUT) {
 			fdcobsync (f->fd);
 		}
+		if (ret != COB_STATUS_00_SUCCESS) {
+			return ret;
+		}
 		return COB_STATUS_07_SUCCESS_NO_UNIT;
 	}
 }
@@ -4413,42 +5815,57 @@ cob_file_close (cob_file_api *a, cob_file *f, const int opt)
 static int
 open_next (cob_file *f)
 {
-	if (f->flag_is_concat
-	 && *f->nxt_filename != 0) {
-		char	*nx = strchr(f->nxt_filename,file_setptr->cob_concat_sep[0]);
-		close (f->fd);
+	struct cob_concat	*cc = f->concat;
+	int		ztype;
+
+	if (!f->flag_is_concat
+	 || cc == NULL
+	 || cc->cur + 1 >= cc->count)
+		return 0;
+	cob_concat_ahead (f);		/* If not done yet */
+	cob_prefetch_stop (f);
+	close (f->fd);
+	if (f->file)
+		fclose (f->file);
+	f->file = NULL;
+	f->zstream = NULL;
+	cc->done += cc->size[cc->cur];
+	cc->cur++;
+	f->fd = cc->nextfd;
+	cc->nextfd = -1;
+	if (cc->cur + 1 < cc->count) {
+		f->nxt_filename = cc->name[cc->cur + 1];
+	} else {
+		f->nxt_filename = NULL;
+		f->flag_is_concat = 0;
+	}
+	if (f->fd == -1)
+		return 0;
+	ztype = cob_zs_type (f, cc->name[cc->cur]);
+	if (cob_iobuf_mapped (f)) {
+		/* The next member is not locked, so it is not mapped */
+		cob_iobuf_free (f);
+		cob_iobuf_alloc (f, f->iobuf_size);
+	}
+	cob_iobuf_reset (f, 0);
+	if (f->open_mode == COB_OPEN_INPUT) {
+		f->file = (void*)fdopen(f->fd, "r");
+	} else { 
+		f->file = (void*)fdopen(f->fd, "r+");
+	}
+	if (cob_zs_check (ztype, f->open_mode) != 0
+	 || cob_zs_attach (f, ztype) != 0) {
 		if (f->file)
 			fclose (f->file);
-		f->fd = -1;
 		f->file = NULL;
-		if (nx) {
-			*nx = 0;
-			if (f->open_mode == COB_OPEN_I_O)	
-				f->fd = open (f->nxt_filename, O_RDWR);
-			else
-				f->fd = open (f->nxt_filename, O_RDONLY);
-			f->nxt_filename = nx + 1;
-		} else {
-			if (f->open_mode == COB_OPEN_I_O)	
-				f->fd = open (f->nxt_filename, O_RDWR);
-			else
-				f->fd = open (f->nxt_filename, O_RDONLY);
-			f->flag_is_concat = 0;
-			if (f->org_filename) {
-				cob_cache_free (f->org_filename);
-				f->org_filename = NULL;
-			}
-		}
-		if (f->fd != -1) {
-			if (f->open_mode == COB_OPEN_INPUT) {
-			   f->file = (void*)fdopen(f->fd, "r");
-			} else { 
-				   f->file = (void*)fdopen(f->fd, "r+");
-			}
-			return 1;
-		}
+		f->fd = -1;
+		return 0;
 	}
-	return 0;
+	if (f->open_mode == COB_OPEN_INPUT) {
+		cob_prefetch_start (f);
+	}
+	cob_concat_ahead (f);
+	return 1;
 }
 
 /* SEQUENTIAL */
@@ -4472,15 +5889,19 @@ again:
 	}
 	if(f->record_off == -1) {
 		f->record_off = set_file_pos (f, (off_t)f->file_header); /* Set current file position */
+		cob_iobuf_reset (f, f->record_off);
+	} else if (f->iobuf) {
+		f->record_off = cob_iobuf_tell (f);	/* Position of data in buffer */
 	} else {
-		f->record_off = lseek (f->fd, 0, SEEK_CUR);	/* Get current file position */
+		f->record_off = cob_sys_tell (f);	/* Get current file position */
 		set_file_pos (f, (off_t)f->record_off);
 	}
+	cob_prefetch_note (f, (off_t)f->record_off);
 
 	if (f->record_min != f->record_max) {
 		/* Read record size */
 
-		bytesread = read (f->fd, recsize.sbuff, f->record_prefix);
+		bytesread = cob_iobuf_read (f, recsize.sbuff, f->record_prefix);
 		if (bytesread == 0
 		 && open_next (f))
 			goto again;
@@ -4526,7 +5947,7 @@ again:
 	}
 
 	/* Read record */
-	bytesread = read (f->fd, f->record->data, f->record->size);
+	bytesread = cob_iobuf_read (f, f->record->data, f->record->size);
 	if (bytesread == 0
 	 && open_next (f))
 		goto again;
@@ -4535,7 +5956,7 @@ again:
 	&&  f->file_format == COB_FILE_IS_MF) {
 		padlen = ((f->record->size + f->record_prefix + 3) / 4 * 4) - (f->record->size + f->record_prefix);
 		if(padlen > 0)
-			if (read(f->fd, recsize.sbuff, padlen) != padlen) /* Read past padding chars */
+			if (cob_iobuf_read (f, recsize.sbuff, padlen) != padlen) /* Read past padding chars */
 				return COB_STATUS_30_PERMANENT_ERROR;
 	}
 	if (bytesread != (int)f->record->size) {
@@ -4568,6 +5989,17 @@ sequential_write (cob_file_api *a, cob_file *f, int opt)
 	 && f->file_format != COB_FILE_IS_MF)
 		opt = 0;
 
+	if (f->iobuf != NULL
+	 && (opt != 0
+	  || f->flag_needs_cr
+	  || (f->file_features & COB_FILE_LS_CRLF))) {
+		/* ADVANCING is done via 'FILE *' so stop buffering this file */
+		if (cob_iobuf_flush (f)) {
+			return errno_cob_sts (COB_STATUS_30_PERMANENT_ERROR);
+		}
+		cob_iobuf_free (f);
+	}
+
 	/* WRITE AFTER */
 	if (opt & COB_WRITE_AFTER) {
 		if (cob_seq_write_opt (f, opt)) {
@@ -4582,26 +6014,32 @@ sequential_write (cob_file_api *a, cob_file *f, int opt)
 		cob_file_sync (f);
 	}
 
-	if (f->open_mode == COB_OPEN_EXTEND
+	if (f->iobuf != NULL
+	 && f->record_off != -1) {
+		f->record_off = cob_iobuf_tell (f);	/* Position after pending data */
+	} else if (f->open_mode == COB_OPEN_EXTEND
 	 && f->file_header == 0) {
 		f->record_off = set_file_pos (f, -1);
 	} else if(f->record_off == -1) {
 		f->record_off = set_file_pos (f, (off_t)f->file_header);
+		cob_iobuf_reset (f, f->record_off);
 	} else {
-		f->record_off = lseek (f->fd, 0, SEEK_CUR);	/* Get current file position */
+		f->record_off = cob_sys_tell (f);	/* Get current file position */
 		set_file_pos (f, (off_t)f->record_off);
 	}
 
 	cob_seq_write_rcsz (f, f->record->size);
 
 	/* Write record */
-	COB_CHECKED_WRITE (f->fd, f->record->data, f->record->size);
+	if (cob_iobuf_write (f, f->record->data, f->record->size) != (int)f->record->size) {
+		return errno_cob_sts (COB_STATUS_30_PERMANENT_ERROR);
+	}
 
 	if (f->record_min != f->record_max
 	 && f->file_format == COB_FILE_IS_MF) {
 		padlen = ((f->record->size + f->record_prefix + 3) / 4 * 4) - (f->record->size + f->record_prefix);
 		while(padlen-- > 0)
-			if(write(f->fd, " ",1) != 1)
+			if(cob_iobuf_write(f, " ",1) != 1)
 				return COB_STATUS_30_PERMANENT_ERROR;
 	}
 	if (f->record_min == f->record_max		/* Fixed Size so CR/LF may be used */
@@ -4636,6 +6074,7 @@ sequential_rewrite (cob_file_api *a, cob_file *f, const int opt)
 	COB_UNUSED (opt);
 
 	f->flag_operation = 1;
+	cob_iobuf_reset (f, -1);	/* Next READ continues from 'fd' position */
 	if (f->record_off != -1) {
 		if (lseek (f->fd, f->record_off, SEEK_SET) == -1) {
 			return COB_STATUS_30_PERMANENT_ERROR;
@@ -4723,6 +6162,88 @@ sequential_rewrite (cob_file_api *a, cob_file *f, const int opt)
 #define IS_BAD_CHAR(x) (x < ' ' && x != COB_CHAR_BS && x != COB_CHAR_ESC \
 					 && x != COB_CHAR_FF && x != COB_CHAR_SI && x != COB_CHAR_TAB)
 /* LINE SEQUENTIAL */
+/* Longest line (without LF) past the record size the fast path reads */
+#define COB_LS_LINE_MARGIN	256
+
+/*
+ * Read a complete line and move it to the record in one go
+ * Returns 1 if the record was read, 0 on End-of-File and
+ * -1 if the line needs to be processed character by character;
+ * the file is then positioned back to the start of the line,
+ * -2 if that is not possible (compressed line longer than the
+ * data kept for positioning back)
+ * At most COB_LS_LINE_MARGIN bytes more than the record are read,
+ * longer lines are left to the slow path, so that a file without
+ * line feeds is not read into memory as a whole; this is also done
+ * for lines containing NUL and a last line without LF
+ */
+static int
+lineseq_read_line (cob_file *f)
+{
+	struct cob_iobuf	*b;
+	char		*line;
+	unsigned char	*p;
+	size_t		len, i, size;
+
+	size = (size_t)f->record_max + COB_LS_LINE_MARGIN + 1;
+	if (f->iobuf == NULL) {
+		cob_iobuf_alloc (f, size);
+	}
+	b = f->iobuf;
+	if (b->size < size) {
+		b->data = cob_realloc (b->data, b->size, size);
+		b->size = size;
+	}
+	line = (char *)b->data;
+	if (fgets (line, (int)size, (FILE *)f->file) == NULL) {
+		return 0;
+	}
+	len = strlen (line);
+	if (len == 0
+	 || line[len - 1] != '\n') {
+		goto slow_path;		/* Line too long, with NUL or without LF */
+	}
+	len--;
+	if (len > 0
+	 && line[len - 1] == '\r') {	/* Ignore CR on reading */
+		len--;
+	}
+	if ((len > f->record_max
+	  && (f->file_features & COB_FILE_LS_SPLIT))
+	 || memchr (line, '\r', len) != NULL
+	 || memchr (line, '\f', len) != NULL
+	 || (f->flag_ls_instab
+	  && memchr (line, COB_CHAR_TAB, len) != NULL)) {
+		goto slow_path;
+	}
+	if ((f->file_features & COB_FILE_LS_VALIDATE)) {
+		p = (unsigned char *)line;
+		for (i = 0; i < len; i++) {
+			if (IS_BAD_CHAR (p[i])
+			 || (p[i] > 0x7E && !isprint (p[i]))) {
+				goto slow_path;		/* to get the status at the right position */
+			}
+		}
+	}
+	if (len > f->record_max) {
+		len = f->record_max;
+	}
+	memcpy (f->record->data, line, len);
+	if (len < f->record_max) {
+		/* Fill the record with spaces */
+		memset ((unsigned char *)f->record->data + len, ' ',
+					f->record_max - len);
+	}
+	f->record->size = len;
+	return 1;
+
+slow_path:
+	if (fseek ((FILE *)f->file, f->record_off, SEEK_SET) != 0) {
+		return -2;
+	}
+	return -1;
+}
+
 static int
 lineseq_read (cob_file_api *a, cob_file *f, const int read_opts)
 {
@@ -4738,8 +6259,30 @@ lineseq_read (cob_file_api *a, cob_file *f, const int read_opts)
 	if (f->file == NULL)
 		return COB_STATUS_30_PERMANENT_ERROR;
 again:
-	if (!f->flag_is_pipe)
+	if (!f->flag_is_pipe) {
 		f->record_off = ftell ((FILE *)f->file);	/* Save position at start of line */
+		cob_prefetch_note (f, (off_t)f->record_off);
+	}
+	if (!f->flag_is_pipe
+	 && !f->flag_is_std) {
+		n = lineseq_read_line (f);
+		if (n == -2) {
+			return COB_STATUS_30_PERMANENT_ERROR;
+		}
+		if (n == 0) {
+			if (f->zstream
+			 && ferror ((FILE *)f->file))	/* Bad compressed data */
+				return COB_STATUS_30_PERMANENT_ERROR;
+			if (open_next (f))
+				goto again;
+			return COB_STATUS_10_END_OF_FILE;
+		}
+		if (n > 0) {
+			if (f->open_mode == COB_OPEN_I_O)	/* Required on some systems */
+				fflush((FILE*)f->file); 
+			return COB_STATUS_00_SUCCESS;
+		}
+	}
 	for (; ;) {
 		n = getc ((FILE *)f->file);
 		if (n == EOF) {
@@ -4827,7 +6370,10 @@ again:
 static size_t
 lineseq_size (cob_file *f)
 {
-	size_t size,i;
+	const unsigned char	*p;
+	cob_u64_t	w, spaces;
+	size_t		i;
+
 	if ((f->file_features & COB_FILE_LS_FIXED))
 		return f->record->size;
 	if (f->variable_record) {
@@ -4838,17 +6384,68 @@ lineseq_size (cob_file *f)
 	}
 	if (f->record->size < f->record_min)
 		f->record->size = f->record_min;
-	if (f->record->size == 0)
-		return 0;
-	for (i = f->record->size - 1; ; --i) {
-		if (f->record->data[i] != ' ') {
-			i++;
+	p = f->record->data;
+	i = f->record->size;
+	/* Skip trailing SPACES a word at a time, then byte by byte */
+	memset (&spaces, ' ', sizeof (spaces));
+	while (i >= sizeof (w)) {
+		memcpy (&w, p + i - sizeof (w), sizeof (w));
+		if (w != spaces)
 			break;
+		i -= sizeof (w);
+	}
+	while (i > 0 && p[i - 1] == ' ')
+		i--;
+	return i;
+}
+
+/*
+ * Write the record plus its line terminator with a single fwrite;
+ * used for the plain WRITE of a record that needs no escaping
+ */
+static int
+lineseq_write_line (cob_file *f, size_t size)
+{
+	struct cob_iobuf	*b;
+	unsigned char	*p;
+	size_t		len;
+
+	if (f->file_features & COB_FILE_LS_VALIDATE) {
+		p = f->record->data;
+		for (len = 0; len < size; ++len, ++p) {
+			if (IS_BAD_CHAR (*p)) {
+				return COB_STATUS_71_BAD_CHAR;
+			}
 		}
-		if (i == 0) break;
 	}
-	size = i;
-	return size;
+	if (f->iobuf == NULL) {
+		cob_iobuf_alloc (f, (size_t)f->record_max + 2);
+	}
+	b = f->iobuf;
+	if (b->size < size + 2) {
+		b->data = cob_realloc (b->data, b->size, size + 2);
+		b->size = size + 2;
+	}
+	memcpy (b->data, f->record->data, size);
+	len = size;
+	if (size > 0
+	 && (f->file_features & COB_FILE_LS_CRLF)) {
+		f->flag_needs_cr = 1;
+	}
+	if (f->flag_needs_cr) {
+		b->data[len++] = '\r';
+		f->flag_needs_cr = 0;
+	}
+	b->data[len++] = '\n';
+	f->flag_needs_nl = 0;
+	/* LCOV_EXCL_START */
+	if (fwrite (b->data, len, (size_t)1, (FILE *)f->file) != 1) {
+		return errno_cob_sts (COB_STATUS_30_PERMANENT_ERROR);
+	}
+	/* LCOV_EXCL_STOP */
+	if (f->open_mode == COB_OPEN_I_O)	/* Required on some systems */
+		fflush((FILE*)f->file); 
+	return COB_STATUS_00_SUCCESS;
 }
 
 static int
@@ -4864,6 +6461,19 @@ lineseq_write (cob_file_api *a, cob_file *f, const int opt)
 	/* Determine the size to be written */
 	size = lineseq_size (f);
 
+	/* Plain WRITE (BEFORE 1 LINE as generated by cobc, or no ADVANCING)
+	   of a record without NUL escaping is done in one go */
+	if (!f->flag_is_pipe
+	 && !(f->flag_select_features & COB_SELECT_LINAGE)
+	 && !(f->file_features & COB_FILE_LS_NULLS)
+	 && ((opt == 0
+	   && (f->file_features & (COB_FILE_LS_LF | COB_FILE_LS_CRLF)))
+	  || (opt == (COB_WRITE_BEFORE | COB_WRITE_LINES | 1)
+	   && f->last_write_mode == COB_LAST_WRITE_BEFORE))) {
+		f->record_off = ftell ((FILE *)f->file);
+		return lineseq_write_line (f, size);
+	}
+
 	fo = (FILE*)f->file;
 	if (f->flag_is_pipe) {
 		if (f->fdout >= 0) {
@@ -5160,6 +6770,85 @@ lineseq_rewrite (cob_file_api *a, cob_file *f, const int opt)
 }
 
 /* RELATIVE */
+/*
+ * Position, read and size of a relative file,
+ * taken from the mapping if the file is mapped
+ */
+static off_t
+relative_seek (cob_file *f, off_t off)
+{
+	if (cob_iobuf_mapped (f)) {
+		cob_iobuf_reset (f, off);
+		return off;
+	}
+	return set_file_pos (f, off);
+}
+
+static off_t
+relative_tell (cob_file *f)
+{
+	if (cob_iobuf_mapped (f))
+		return cob_iobuf_tell (f);
+	return lseek (f->fd, 0, SEEK_CUR);
+}
+
+static int
+relative_get (cob_file *f, void *data, size_t len)
+{
+	if (cob_iobuf_mapped (f))
+		return cob_iobuf_read (f, data, len);
+	return (int)read (f->fd, data, len);
+}
+
+static int
+relative_stat (cob_file *f, struct stat *st)
+{
+	if (cob_iobuf_mapped (f)) {
+		st->st_size = (off_t)((struct cob_iobuf *)f->iobuf)->size;
+		return 0;
+	}
+	return fstat (f->fd, st);
+}
+
+/*
+ * Return record size from relative record prefix, 0 = deleted
+ */
+static size_t
+relative_prefix_size (cob_file *f, const unsigned char *rechdr)
+{
+	size_t	relsize = 0;
+
+	switch (f->file_format) {
+	case COB_FILE_IS_B32:		/* Was 32bit Big Endian system */
+		relsize = LDCOMPX4(rechdr);
+		break;
+	case COB_FILE_IS_B64:		/* Was 64bit Big Endian system */
+		relsize = LDCOMPX4(((unsigned char *)&rechdr[4]));
+		break;
+	case COB_FILE_IS_L32:		/* Was 32bit Little Endian system */
+		relsize = LDBINLE4(rechdr);
+		break;
+	case COB_FILE_IS_L64:		/* Was 64bit Little Endian system */
+		relsize = LDBINLE4(rechdr);
+		break;
+	case COB_FILE_IS_MF:
+		if (f->record_prefix == 2) {
+			relsize = ((rechdr[0] & 0x0F) << 8) + rechdr[1];
+		} else {
+			relsize = ((rechdr[0] & 0x0F) << 24) + (rechdr[1] << 16) 
+				+ (rechdr[2] << 8) + rechdr[3];
+		}
+		if ((rechdr[0] & 0x20)) {
+			relsize = 0;	/* Deleted record */
+		}
+		break;
+	default:
+		memcpy (&relsize, rechdr, sizeof(relsize));	/* Local native 'size_t' */
+		break;
+	}
+	return relsize;
+}
+
 /*
  * Return size of relative record at given offset
  */
@@ -5170,54 +6859,28 @@ relative_read_size (cob_file *f, off_t off, int *isdeleted)
 	unsigned char rechdr[8];
 
 	*isdeleted = 0;
-	if (set_file_pos (f, off) == -1)
+	cob_iobuf_reset (f, -1);	/* Write pending data before reading */
+	if (relative_seek (f, off) == -1)
 		return -1;
 	if (f->record_prefix > 0) {
 		memset (rechdr,0,sizeof(rechdr));
-		if (read (f->fd, rechdr, f->record_prefix) != f->record_prefix) {
+		if (relative_get (f, rechdr, f->record_prefix) != f->record_prefix) {
 			return -1;
 		}
-		switch (f->file_format) {
-		case COB_FILE_IS_B32:		/* Was 32bit Big Endian system */
-			relsize = LDCOMPX4(rechdr);
-			break;
-		case COB_FILE_IS_B64:		/* Was 64bit Big Endian system */
-			relsize = LDCOMPX4(((unsigned char *)&rechdr[4]));
-			break;
-		case COB_FILE_IS_L32:		/* Was 32bit Little Endian system */
-			relsize = LDBINLE4(rechdr);
-			break;
-		case COB_FILE_IS_L64:		/* Was 64bit Little Endian system */
-			relsize = LDBINLE4(rechdr);
-			break;
-		case COB_FILE_IS_MF:
-			if (f->record_prefix == 2) {
-				relsize = ((rechdr[0] & 0x0F) << 8) + rechdr[1];
-			} else {
-				relsize = ((rechdr[0] & 0x0F) << 24) + (rechdr[1] << 16) 
-					+ (rechdr[2] << 8) + rechdr[3];
-			}
-			if ((rechdr[0] & 0x20)) {
-				relsize = 0;	/* Deleted record */
-			}
-			break;
-		default:
-			memcpy (&relsize, rechdr, sizeof(relsize));	/* Local native 'size_t' */
-			break;
-		}
+		relsize = relative_prefix_size (f, rechdr);
 		if (relsize <= 0) {
 			*isdeleted = 1;
 		}
 		return (int)relsize;
 	} else
 	if (f->file_format == COB_FILE_IS_MF) {
-		if (lseek (f->fd, (off + (off_t)f->record_slot - 1), SEEK_SET) == -1 ) {
+		if (relative_seek (f, (off + (off_t)f->record_slot - 1)) == -1 ) {
 			return -1;
 		}
 		rechdr[0] = 0;
-		if (read (f->fd, rechdr, 1) != 1)
+		if (relative_get (f, rechdr, 1) != 1)
 			return COB_STATUS_30_PERMANENT_ERROR;
-		set_file_pos (f, off);
+		relative_seek (f, off);
 		if (rechdr[0] == 0) {
 			*isdeleted = 1;
 			return 0;
@@ -5228,31 +6891,213 @@ relative_read_size (cob_file *f, off_t off, int *isdeleted)
 	return 0;
 }
 
-/* RELATIVE  START */
-static int
-relative_start (cob_file_api *a, cob_file *f, const int cond, cob_field *k)
+/*
+ * Map of the used slots of a RELATIVE file, one bit per slot;
+ * built on first use by reading the complete file and then kept
+ * up to date by WRITE and DELETE, so empty slots can be skipped
+ * 64 at a time by START and READ NEXT/PREVIOUS;
+ * only used while the file is locked exclusively, as changes of
+ * other processes would not be seen
+ */
+struct cob_relmap {
+	cob_u64_t	*bits;		/* Bit set if slot holds a record */
+	size_t		words;		/* Allocated size of 'bits' */
+	size_t		slots;		/* Number of slots covered */
+};
+
+static void
+cob_relmap_free (cob_file *f)
 {
-	off_t		off;
-	size_t		relsize;
-	int		kindex;
-	int		ksindex;
-	int		kcond, isdeleted;
-	struct stat	st;
-	COB_UNUSED (a);
+	struct cob_relmap	*m = f->relmap;
 
-	if (fstat (f->fd, &st) != 0 || st.st_size == 0) {
-		return COB_STATUS_23_KEY_NOT_EXISTS;
-	}
+	if (m == NULL)
+		return;
+	cob_free (m->bits);
+	cob_free (m);
+	f->relmap = NULL;
+}
 
-	/* Get the index */
-	f->flag_first_read = 0;
-	switch (cond) {
-	case COB_FI:
-		kcond = COB_GE;
-		kindex = 0;
-		f->flag_first_read = 1;
-		break;
-	case COB_LA:
+/* Check if the slot image holds an active record */
+static int
+relative_slot_used (cob_file *f, const unsigned char *slot)
+{
+	if (f->record_prefix > 0) {
+		if (relative_prefix_size (f, slot) == 0)
+			return 0;
+	} else
+	if (f->file_format != COB_FILE_IS_MF) {
+		return 0;
+	}
+	if (f->file_format == COB_FILE_IS_MF
+	 && slot[f->record_slot - 1] == 0x00) {	/* Flagged Deleted */
+		return 0;
+	}
+	return 1;
+}
+
+/* Return the map of used slots, building it if needed */
+static struct cob_relmap *
+cob_relmap_get (cob_file *f)
+{
+	struct cob_relmap	*m;
+	struct stat	st;
+	unsigned char	*buff;
+	size_t		i, j, n, chunk;
+
+	if (!f->flag_file_lock) {	/* Others may change the file */
+		cob_relmap_free (f);
+		return NULL;
+	}
+	if (f->relmap != NULL
+	 || !f->flag_relmap
+	 || f->record_slot == 0)
+		return f->relmap;
+	cob_iobuf_reset (f, -1);	/* Write pending data before reading */
+	if (relative_stat (f, &st) != 0)
+		return NULL;
+	m = cob_malloc (sizeof (struct cob_relmap));
+	if (st.st_size > (off_t)f->file_header) {
+		m->slots = (size_t)((st.st_size - f->file_header) / f->record_slot);
+	}
+	m->words = m->slots / 64 + 1;
+	m->bits = cob_malloc (m->words * sizeof (cob_u64_t));
+	chunk = (1024 * 1024) / f->record_slot + 1;
+	buff = cob_malloc (chunk * f->record_slot);
+	if (relative_seek (f, (off_t)f->file_header) == -1) {
+		m->slots = 0;
+	}
+	for (i = 0; i < m->slots; i += n) {
+		n = m->slots - i;
+		if (n > chunk)
+			n = chunk;
+		if (relative_get (f, buff, n * f->record_slot) != (int)(n * f->record_slot)) {
+			cob_free (buff);
+			cob_free (m->bits);
+			cob_free (m);
+			return NULL;
+		}
+		for (j = 0; j < n; j++) {
+			if (relative_slot_used (f, buff + j * f->record_slot)) {
+				m->bits[(i + j) / 64] |= (cob_u64_t)1 << ((i + j) % 64);
+			}
+		}
+	}
+	cob_free (buff);
+	f->relmap = m;
+	return m;
+}
+
+/* Mark slot as used or empty */
+static void
+cob_relmap_set (cob_file *f, size_t slot, int used)
+{
+	struct cob_relmap	*m = f->relmap;
+	size_t		words;
+
+	if (m == NULL)
+		return;
+	if (slot / 64 >= m->words) {
+		words = m->words * 2;
+		if (words <= slot / 64)
+			words = slot / 64 + 1;
+		m->bits = cob_realloc (m->bits, m->words * sizeof (cob_u64_t),
+						words * sizeof (cob_u64_t));
+		m->words = words;
+	}
+	if (used) {
+		m->bits[slot / 64] |= (cob_u64_t)1 << (slot % 64);
+		if (slot >= m->slots)
+			m->slots = slot + 1;
+	} else {
+		m->bits[slot / 64] &= ~((cob_u64_t)1 << (slot % 64));
+	}
+}
+
+static int
+cob_relmap_used (struct cob_relmap *m, int slot)
+{
+	return slot >= 0
+	    && (size_t)slot < m->slots
+	    && (m->bits[slot / 64] & ((cob_u64_t)1 << (slot % 64))) != 0;
+}
+
+/* Return first used slot >= 'slot', -1 if there is none */
+static int
+cob_relmap_next (struct cob_relmap *m, int slot)
+{
+	cob_u64_t	w;
+	size_t		i;
+
+	if (slot < 0)
+		slot = 0;
+	if ((size_t)slot >= m->slots)
+		return -1;
+	i = slot / 64;
+	w = m->bits[i] & (~(cob_u64_t)0 << (slot % 64));
+	while (w == 0) {
+		if (++i >= m->words)
+			return -1;
+		w = m->bits[i];
+	}
+	for (slot = (int)(i * 64); !(w & 1); w >>= 1)
+		slot++;
+	return slot;
+}
+
+/* Return last used slot <= 'slot', -1 if there is none */
+static int
+cob_relmap_prev (struct cob_relmap *m, int slot)
+{
+	cob_u64_t	w;
+	size_t		i;
+
+	if (slot < 0
+	 || m->slots == 0)
+		return -1;
+	if ((size_t)slot >= m->slots)
+		slot = (int)m->slots - 1;
+	i = slot / 64;
+	w = m->bits[i];
+	if (slot % 64 != 63)
+		w &= ((cob_u64_t)1 << (slot % 64 + 1)) - 1;
+	while (w == 0) {
+		if (i == 0)
+			return -1;
+		w = m->bits[--i];
+	}
+	for (slot = (int)(i * 64 + 63); !(w & ((cob_u64_t)1 << 63)); w <<= 1)
+		slot--;
+	return slot;
+}
+
+/* RELATIVE  START */
+static int
+relative_start (cob_file_api *a, cob_file *f, const int cond, cob_field *k)
+{
+	off_t		off;
+	size_t		relsize;
+	int		kindex;
+	int		ksindex;
+	int		kcond, isdeleted;
+	struct stat	st;
+	struct cob_relmap	*m;
+	COB_UNUSED (a);
+
+	cob_iobuf_reset (f, -1);	/* Write pending data before fstat */
+	if (relative_stat (f, &st) != 0 || st.st_size == 0) {
+		return COB_STATUS_23_KEY_NOT_EXISTS;
+	}
+	m = cob_relmap_get (f);
+
+	/* Get the index */
+	f->flag_first_read = 0;
+	switch (cond) {
+	case COB_FI:
+		kcond = COB_GE;
+		kindex = 0;
+		f->flag_first_read = 1;
+		break;
+	case COB_LA:
 		kcond = COB_LE;
 		kindex = (st.st_size - f->file_header) / f->record_slot - 1;
 		break;
@@ -5300,6 +7145,14 @@ relative_start (cob_file_api *a, cob_file *f, const int cond, cob_field *k)
 
 	/* Seek index */
 	for (;;) {
+		if (m != NULL
+		 && kcond != COB_EQ) {	/* Skip empty slots */
+			if (kcond == COB_LT || kcond == COB_LE) {
+				kindex = cob_relmap_prev (m, kindex);
+			} else {
+				kindex = cob_relmap_next (m, kindex);
+			}
+		}
 		if (kindex < 0) {
 			break;
 		}
@@ -5316,7 +7169,7 @@ relative_start (cob_file_api *a, cob_file *f, const int cond, cob_field *k)
 		/* Check if a valid record */
 		if (relsize > 0 && !isdeleted) {
 			f->record_off = off;
-			set_file_pos (f, off);	/* Set file position to start of record */
+			relative_seek (f, off);	/* Set file position to start of record */
 			if (f->access_mode == COB_ACCESS_SEQUENTIAL
 			&&  f->keys[0].field) {
 				f->cur_rec_num = (((off - f->file_header) / f->record_slot) + 1);
@@ -5358,7 +7211,7 @@ relative_read_off (cob_file *f, off_t off)
 
 	if (relsize == 0 || isdeleted) {
 		f->record->size = 0;
-		set_file_pos (f, off);
+		relative_seek (f, off);
 		return COB_STATUS_23_KEY_NOT_EXISTS;
 	}
 
@@ -5366,7 +7219,7 @@ relative_read_off (cob_file *f, off_t off)
 		return COB_STATUS_30_PERMANENT_ERROR;
 	}
 
-	if (read (f->fd, f->record->data, (size_t)relsize) != relsize) {
+	if (relative_get (f, f->record->data, (size_t)relsize) != relsize) {
 		return COB_STATUS_30_PERMANENT_ERROR;
 	}
 	f->record->size = relsize;
@@ -5376,19 +7229,19 @@ relative_read_off (cob_file *f, off_t off)
 		f->cur_rec_num = (((off - f->file_header) / f->record_slot) + 1);
 		cob_set_int (f->keys[0].field, 0);
 		if (cob_add_int (f->keys[0].field, (int)f->cur_rec_num, COB_STORE_KEEP_ON_OVERFLOW) != 0) {
-			set_file_pos (f, off);
+			relative_seek (f, off);
 			return COB_STATUS_14_OUT_OF_KEY_RANGE;
 		}
 	}
 	if (f->file_format == COB_FILE_IS_MF) {
 		if(f->record_min != f->record_max) {
-			lseek (f->fd, (off + (off_t)f->record_slot - 1), SEEK_SET);
+			relative_seek (f, (off + (off_t)f->record_slot - 1));
 		}
-		if (read (f->fd, recmark, 1) != 1)	/* Active Record marker */
+		if (relative_get (f, recmark, 1) != 1)	/* Active Record marker */
 			return COB_STATUS_30_PERMANENT_ERROR;
 		if (recmark[0] == 0x00) {	/* Flagged Deleted */
 			f->record->size = 0;
-			set_file_pos (f, off);
+			relative_seek (f, off);
 			return COB_STATUS_23_KEY_NOT_EXISTS;
 		}
 	}
@@ -5413,7 +7266,7 @@ relative_read (cob_file_api *a, cob_file *f, cob_field *k, const int read_opts)
 	}
 	off = relnum * f->record_slot + f->file_header;
 
-	if (fstat (f->fd, &st) != 0 || st.st_size == 0) {
+	if (relative_stat (f, &st) != 0 || st.st_size == 0) {
 		return COB_STATUS_10_END_OF_FILE;
 	}
 	if(off >= st.st_size) {
@@ -5451,6 +7304,7 @@ relative_read_next (cob_file_api *a, cob_file *f, const int read_opts)
 	struct stat	st;
 	int		sts = 0;
 	int		errsts;
+	struct cob_relmap	*m;
 	COB_UNUSED (a);
 
 	if (f->flag_operation != 0) {
@@ -5458,7 +7312,7 @@ relative_read_next (cob_file_api *a, cob_file *f, const int read_opts)
 	}
 
 	relsize = (off_t)f->record_slot;
-	if (fstat (f->fd, &st) != 0 || st.st_size == 0) {
+	if (relative_stat (f, &st) != 0 || st.st_size == 0) {
 		return COB_STATUS_10_END_OF_FILE;
 	}
 	/* LCOV_EXCL_START */
@@ -5468,9 +7322,9 @@ relative_read_next (cob_file_api *a, cob_file *f, const int read_opts)
 	/* LCOV_EXCL_STOP */
 
 	if(f->record_off == -1) {
-		curroff = lseek (f->fd, (off_t)f->file_header, SEEK_SET);	/* Set current file position */
+		curroff = relative_seek (f, (off_t)f->file_header);	/* Set current file position */
 	} else {
-		curroff = lseek (f->fd, 0, SEEK_CUR);	/* Get current file position */
+		curroff = relative_tell (f);	/* Get current file position */
 	}
 	if (f->flag_operation != 0) {
 		f->flag_operation = 0;
@@ -5500,9 +7354,22 @@ relative_read_next (cob_file_api *a, cob_file *f, const int read_opts)
 		break;
 	}
 
+	m = cob_relmap_get (f);
 	for (;;) {
 		if(st.st_size <= curroff)
 			break;
+		if (m != NULL
+		 && curroff >= (off_t)f->file_header) {	/* Skip empty slots */
+			relnum = (int)((curroff - f->file_header) / f->record_slot);
+			if (moveback) {
+				relnum = cob_relmap_prev (m, relnum);
+			} else {
+				relnum = cob_relmap_next (m, relnum);
+			}
+			if (relnum < 0)
+				break;
+			curroff = (off_t)relnum * f->record_slot + f->file_header;
+		}
 		set_lock_opts (f, read_opts);
 		if(f->flag_lock_rec) {
 			relnum = ((curroff - f->file_header) / f->record_slot) + 1;
@@ -5530,7 +7397,7 @@ relative_read_next (cob_file_api *a, cob_file *f, const int read_opts)
 		sts = relative_read_off (f, curroff);
 
 		if (sts == COB_STATUS_00_SUCCESS) {
-			set_file_pos (f, curroff + f->record_slot);
+			relative_seek (f, curroff + f->record_slot);
 			return COB_STATUS_00_SUCCESS;
 		}
 		if (sts == COB_STATUS_30_PERMANENT_ERROR
@@ -5540,8 +7407,8 @@ relative_read_next (cob_file_api *a, cob_file *f, const int read_opts)
 		}
 next_record:
 		if (moveback) {
-			if (curroff > (f->record_slot + f->file_header)) {
-				curroff -= (f->record_slot * 2);
+			if (curroff >= (off_t)(f->record_slot + f->file_header)) {
+				curroff -= f->record_slot;
 			} else {
 				break;
 			}
@@ -5561,8 +7428,14 @@ relative_write_size (cob_file *f, off_t off, int recsize)
 	size_t	relsize = 0;
 	unsigned char rechdr[8];
 
-	if (lseek (f->fd, off, SEEK_SET) == -1 ) {
-		return -1;
+	if (f->iobuf == NULL
+	 || off != cob_iobuf_tell (f)) {
+		if (cob_iobuf_flush (f))
+			return -1;
+		if (lseek (f->fd, off, SEEK_SET) == -1 ) {
+			return -1;
+		}
+		cob_iobuf_reset (f, off);
 	}
 	f->record_off = off;
 	if (f->record_prefix > 0) {
@@ -5593,7 +7466,7 @@ relative_write_size (cob_file *f, off_t off, int recsize)
 			memcpy(rechdr, &relsize, sizeof(relsize));	/* Local native 'size_t' */
 			break;
 		}
-		if (write (f->fd, rechdr, f->record_prefix) != f->record_prefix) {
+		if (cob_iobuf_write (f, rechdr, f->record_prefix) != f->record_prefix) {
 			return -1;
 		}
 	}
@@ -5607,12 +7480,12 @@ relative_padout(cob_file *f, char pad, int len)
 	memset(wrk, pad, sizeof(wrk));
 	while(len > sizeof(wrk)) {
 		/* Pad out record on disk */
-		if (write (f->fd, wrk, sizeof(wrk)) != sizeof(wrk))
+		if (cob_iobuf_write (f, wrk, sizeof(wrk)) != sizeof(wrk))
 			return 1;
 		len -= sizeof(wrk);
 	}
 	if(len > 0)
-		if (write (f->fd, wrk, len) != len)
+		if (cob_iobuf_write (f, wrk, len) != len)
 			return 1;
 	return 0;
 }
@@ -5625,6 +7498,7 @@ relative_write (cob_file_api *a, cob_file *f, const int opt)
 	int	isdeleted=0;
 	int	kindex,rcsz;
 	struct stat	st;
+	struct cob_relmap	*m;
 	COB_UNUSED (opt);
 	COB_UNUSED (a);
 
@@ -5640,24 +7514,32 @@ relative_write (cob_file_api *a, cob_file *f, const int opt)
 			return COB_STATUS_24_KEY_BOUNDARY;
 		}
 		off = (off_t) (f->file_header + f->record_slot * kindex);
+		cob_iobuf_reset (f, -1);	/* Write pending data before fstat */
 		if (fstat (f->fd, &st) != 0) {
 			return COB_STATUS_10_END_OF_FILE;
 		}
 		if(off < st.st_size) {
-			relsize = relative_read_size(f, off, &isdeleted);
-			if ((long)relsize < 0)
-				return COB_STATUS_30_PERMANENT_ERROR;
-			if ((long)relsize > 0) {
-				return COB_STATUS_22_KEY_EXISTS;
+			if ((m = cob_relmap_get (f)) != NULL) {
+				if (cob_relmap_used (m, kindex)) {
+					return COB_STATUS_22_KEY_EXISTS;
+				}
+			} else {
+				relsize = relative_read_size(f, off, &isdeleted);
+				if ((long)relsize < 0)
+					return COB_STATUS_30_PERMANENT_ERROR;
+				if ((long)relsize > 0) {
+					return COB_STATUS_22_KEY_EXISTS;
+				}
 			}
 		} else {
 			off = set_file_pos (f, off);	/* Set current file position */
 		}
 	} else {
 		if(f->record_off == -1) {
+			cob_iobuf_reset (f, -1);
 			off = (off_t)lseek (f->fd, (off_t)f->file_header, SEEK_SET);	/* Set current file position */
 		} else {
-			off = (off_t)lseek (f->fd, 0, SEEK_CUR);	/* Get current file position */
+			off = cob_iobuf_tell (f);	/* Get current file position */
 		}
 	}
 
@@ -5674,7 +7556,7 @@ relative_write (cob_file_api *a, cob_file *f, const int opt)
 	if (relsize < 0) {
 		return COB_STATUS_30_PERMANENT_ERROR;
 	}
-	if (write (f->fd, f->record->data, f->record->size) != (int)f->record->size) {
+	if (cob_iobuf_write (f, f->record->data, f->record->size) != (int)f->record->size) {
 		return COB_STATUS_30_PERMANENT_ERROR;
 	}
 	if (relative_padout(f, ' ', f->record_max - f->record->size)) /* Pad out with SPACES */
@@ -5682,12 +7564,13 @@ relative_write (cob_file_api *a, cob_file *f, const int opt)
 
 	if (f->file_format == COB_FILE_IS_MF) {
 		if ((f->file_features & COB_FILE_LS_CRLF)) {	/* Windows format */
-			if (write (f->fd, "\r", 1) != 1)
+			if (cob_iobuf_write (f, "\r", 1) != 1)
 				return COB_STATUS_30_PERMANENT_ERROR;
 		}
-		if (write (f->fd, "\n", 1) != 1)
+		if (cob_iobuf_write (f, "\n", 1) != 1)
 			return COB_STATUS_30_PERMANENT_ERROR;
 	}
+	cob_relmap_set (f, (size_t)((off - f->file_header) / f->record_slot), 1);
 
 	/* Update RELATIVE KEY */
 	if (f->access_mode == COB_ACCESS_SEQUENTIAL) {
@@ -5813,6 +7696,7 @@ relative_delete (cob_file_api *a, cob_file *f)
 		if (ftruncate (f->fd, off))
 			return COB_STATUS_30_PERMANENT_ERROR;
 		f->max_rec_num = (st.st_size - f->file_header) / f->record_slot;
+		cob_relmap_set (f, (size_t)relnum, 0);
 		return COB_STATUS_00_SUCCESS;
 	}
 
@@ -5884,6 +7768,7 @@ relative_delete (cob_file_api *a, cob_file *f)
 			return COB_STATUS_30_PERMANENT_ERROR;
 	}
 	set_file_pos (f, (off_t)f->record_off);
+	cob_relmap_set (f, (size_t)relnum, 0);
 	if (f->flag_record_lock) {
 		unlock_record (f, relnum+1);
 	}
@@ -5904,6 +7789,7 @@ cob_file_unlock (cob_file *f)
 			return;
 		}
 		if (f->organization != COB_ORG_INDEXED) {
+			(void)cob_iobuf_flush (f);	/* Error is kept for next WRITE/CLOSE */
 			if (f->fd >= 0) {
 				fdcobsync (f->fd);
 			}
@@ -5925,6 +7811,8 @@ cob_file_unlock (cob_file *f)
 #endif
 					}
 				}
+				f->flag_file_lock = 0;
+				cob_relmap_free (f);
 			}
 #endif
 
@@ -6010,10 +7898,10 @@ cob_file_destroy (cob_file **pfl)
 			cob_cache_free (fl->keys);
 			fl->keys = NULL;
 		}
-		if (fl->org_filename) {
-			cob_cache_free (fl->org_filename);
-			fl->org_filename = NULL;
-		}
+		cob_prefetch_stop (fl);
+		cob_concat_free (fl);
+		cob_iobuf_free (fl);
+		cob_relmap_free (fl);
 		cob_cache_free (fl);
 		*pfl = NULL;
 	}
@@ -6551,10 +8439,8 @@ cob_open (cob_file *f, const int mode, const int sharing, cob_field *fnstatus)
 	 && file_open_name[0] != '<'
 	 && file_open_name[0] != '|') {
 		f->flag_is_concat = 1;
-		f->org_filename = cob_strdup (file_open_name);
-		f->nxt_filename = strchr(f->org_filename,file_setptr->cob_concat_sep[0]);
-		*f->nxt_filename++ = 0;
-		file_open_name = f->org_filename;
+		strncpy (file_open_name, cob_concat_init (f, file_open_name),
+			 (size_t)COB_FILE_MAX);
 	}
 
 	if (!f->flag_optional
@@ -6577,6 +8463,10 @@ cob_open (cob_file *f, const int mode, const int sharing, cob_field *fnstatus)
 	cob_file_save_status (f, fnstatus,
 		     fileio_funcs[get_io_ptr (f)]->open (&file_api, f, file_open_name,
 								mode, sharing));
+	if (f->file_status[0] == '0'
+	 && f->flag_is_concat) {
+		cob_concat_ahead (f);
+	}
 	if (f->file_status[0] == '0'
 	 && !f->flag_io_tran
 	 && f->flag_do_qbl ) {
@@ -7026,6 +8916,269 @@ cob_write (cob_file *f, cob_field *rec, const int opt, cob_field *fnstatus,
 	}
 }
 
+/*
+ * Size of a record given to cob_write_multi, same as done by cob_write
+ */
+static size_t
+cob_write_multi_size (cob_file *f, const size_t stride)
+{
+	size_t	size;
+
+	if (f->variable_record) {
+		size = (size_t)cob_get_int (f->variable_record);
+		if (size > stride) {
+			size = stride;
+		}
+	} else if (f->flag_redef) {
+		size = f->record_max;
+	} else {
+		size = stride;
+	}
+	return size;
+}
+
+#if defined (COB_USE_WRITEV)
+#define COB_MULTI_BATCH	64	/* Records per writev */
+
+/*
+ * Write 'count' records of a SEQUENTIAL file with writev;
+ * prefix, data and MF padding of up to COB_MULTI_BATCH records
+ * are given to the system in one call
+ * Returns the number of records written, f->file_status is set
+ * for each record as done by cob_write
+ */
+static size_t
+cob_write_multi_vec (cob_file *f, const unsigned char *recs,
+			size_t count, size_t stride)
+{
+	struct iovec	iov[COB_MULTI_BATCH * 3];
+	unsigned char	pfx[COB_MULTI_BATCH][4];
+	size_t		reclen[COB_MULTI_BATCH];
+	size_t		size[COB_MULTI_BATCH];
+	size_t		done = 0, n, i, k, wrote;
+	off_t		pos;
+	ssize_t		wr;
+	int		niov, padlen, sts;
+	int		varrec = f->record_min != f->record_max;
+
+	if (cob_iobuf_flush (f)) {
+		f->last_operation = COB_LAST_WRITE;
+		cob_file_save_status (f, NULL, errno_cob_sts (COB_STATUS_30_PERMANENT_ERROR));
+		return 0;
+	}
+	if (f->open_mode == COB_OPEN_EXTEND
+	 && f->file_header == 0) {
+		pos = set_file_pos (f, -1);
+	} else if (f->record_off == -1) {
+		pos = set_file_pos (f, (off_t)f->file_header);
+	} else {
+		pos = lseek (f->fd, 0, SEEK_CUR);
+	}
+	f->flag_operation = 1;
+	f->flag_was_updated = 1;
+
+	while (done < count) {
+		n = count - done;
+		if (n > COB_MULTI_BATCH)
+			n = COB_MULTI_BATCH;
+		niov = 0;
+		for (i = 0; i < n; i++) {
+			size[i] = cob_write_multi_size (f, stride);
+			if (size[i] < f->record_min || f->record_max < size[i]) {
+				n = i;		/* Write the good ones first */
+				break;
+			}
+			reclen[i] = size[i];
+			if (varrec) {
+				cob_seq_rcsz_prefix (f, (int)size[i], pfx[i]);
+				iov[niov].iov_base = (void *)pfx[i];
+				iov[niov].iov_len = f->record_prefix;
+				niov++;
+				reclen[i] += f->record_prefix;
+			}
+			iov[niov].iov_base = (void *)(recs + (done + i) * stride);
+			iov[niov].iov_len = size[i];
+			niov++;
+			if (varrec
+			 && f->file_format == COB_FILE_IS_MF) {
+				padlen = ((size[i] + f->record_prefix + 3) / 4 * 4)
+					- (size[i] + f->record_prefix);
+				if (padlen > 0) {
+					iov[niov].iov_base = (void *)"   ";
+					iov[niov].iov_len = padlen;
+					niov++;
+					reclen[i] += padlen;
+				}
+			}
+		}
+
+		/* Write the batch, continuing after a partial write */
+		wrote = 0;
+		sts = COB_STATUS_00_SUCCESS;
+		k = 0;
+		while (k < (size_t)niov) {
+			wr = writev (f->fd, &iov[k], niov - (int)k);
+			if (wr <= 0) {
+				sts = errno_cob_sts (COB_STATUS_30_PERMANENT_ERROR);
+				break;
+			}
+			wrote += (size_t)wr;
+			while (k < (size_t)niov
+			    && (size_t)wr >= iov[k].iov_len) {
+				wr -= iov[k].iov_len;
+				k++;
+			}
+			if (wr > 0) {
+				iov[k].iov_base = (char *)iov[k].iov_base + wr;
+				iov[k].iov_len -= wr;
+			}
+		}
+
+		/* File status and statistics per record */
+		for (i = 0; i < n; i++) {
+			if (wrote < reclen[i])
+				break;
+			wrote -= reclen[i];
+			f->record_off = pos;
+			pos += reclen[i];
+			f->cur_rec_num++;
+			if (f->cur_rec_num > f->max_rec_num)
+				f->max_rec_num = f->cur_rec_num;
+			f->last_operation = COB_LAST_WRITE;
+			cob_file_save_status (f, NULL, COB_STATUS_00_SUCCESS);
+		}
+		if (i > 0) {
+			f->record->size = size[i - 1];
+			memcpy (f->record->data, recs + (done + i - 1) * stride, size[i - 1]);
+			f->flag_begin_of_file = 0;
+		}
+		done += i;
+		if (i < n
+		 || sts != COB_STATUS_00_SUCCESS) {
+			if (sts == COB_STATUS_00_SUCCESS)
+				sts = COB_STATUS_30_PERMANENT_ERROR;
+			break;
+		}
+		if (n < COB_MULTI_BATCH
+		 && done < count) {		/* Next record has a bad size */
+			sts = COB_STATUS_44_RECORD_OVERFLOW;
+			break;
+		}
+	}
+	cob_iobuf_reset (f, -1);	/* Written via 'fd' */
+	if (done < count) {
+		f->cur_rec_num++;		/* As done by cob_write */
+		f->last_operation = COB_LAST_WRITE;
+		cob_file_save_status (f, NULL, sts);
+	}
+	return done;
+}
+#endif
+
+/*
+ * Write 'count' records, 'stride' bytes apart starting at 'recs';
+ * the size of each record is taken as for a WRITE of a 'stride' bytes
+ * record area (so from the DEPENDING ON field for variable records);
+ * writing stops at the first record that gets a bad status,
+ * f->file_status is that of the last record written or tried
+ * Returns the number of records written
+ */
+size_t
+cob_write_multi (cob_file *f, const void *recs, size_t count, size_t stride)
+{
+	const unsigned char	*p = recs;
+	cob_field	rec;
+	size_t		i;
+
+	if (count == 0)
+		return 0;
+#if defined (COB_USE_WRITEV)
+	/* The vectored write is done for plain record SEQUENTIAL output,
+	   anything that needs more work per record is done via cob_write */
+	if (f->organization == COB_ORG_SEQUENTIAL
+	 && f->io_routine == COB_IO_SEQUENTIAL
+	 && (f->open_mode == COB_OPEN_OUTPUT
+	  || f->open_mode == COB_OPEN_EXTEND)
+	 && f->fd >= 0
+	 && f->zstream == NULL
+	 && !f->flag_is_pipe
+	 && f->linage == NULL
+	 && !f->flag_needs_cr
+	 && !f->flag_do_qbl
+	 && !f->flag_write_chk_dups
+	 && !(f->file_features & COB_FILE_SYNC)
+	 && !((f->file_features & COB_FILE_LS_CRLF)
+	   && f->record_min == f->record_max)
+	 && !(file_setptr->cob_line_trace && f->trace_io)
+	 && (f->iobuf == NULL
+	  || !((struct cob_iobuf *)f->iobuf)->map)) {
+		f->last_key = NULL;
+		f->flag_read_done = 0;
+		f->last_write_mode = COB_LAST_WRITE_UNKNOWN;
+		return cob_write_multi_vec (f, p, count, stride);
+	}
+#endif
+	rec.attr = &const_alpha_attr;
+	for (i = 0; i < count; i++) {
+		rec.size = stride;
+		rec.data = f->record->data;
+		memcpy (f->record->data, p + i * stride,
+			stride > f->record_max ? f->record_max : stride);
+		cob_write (f, &rec, 0, NULL, 0);
+		if (f->file_status[0] != '0')
+			break;
+	}
+	return i;
+}
+
+/*
+ * Return the size of an open SEQUENTIAL or LINE SEQUENTIAL file, for
+ * concatenated input the size of all members together, -1 if not known;
+ * with 'pos' not NULL it is set to how much of that has been read, which
+ * can be a bit ahead of the current record because of buffering
+ */
+cob_s64_t
+cob_file_input_size (cob_file *f, cob_s64_t *pos)
+{
+	struct cob_concat	*cc;
+	struct stat	st;
+	cob_s64_t	total, done = 0;
+	off_t		cur;
+
+	if (pos != NULL)
+		*pos = 0;
+	if (f == NULL
+	 || f->open_mode == COB_OPEN_CLOSED
+	 || (f->organization != COB_ORG_SEQUENTIAL
+	  && f->organization != COB_ORG_LINE_SEQUENTIAL)
+	 || f->flag_is_pipe
+	 || f->flag_is_std)
+		return -1;
+	cc = f->concat;
+	if (cc != NULL) {
+		total = cc->total;
+		done = cc->done;
+	} else if (f->fd >= 0
+		&& fstat (f->fd, &st) == 0
+		&& S_ISREG (st.st_mode)) {
+		total = (cob_s64_t)st.st_size;
+	} else {
+		return -1;
+	}
+	if (pos != NULL
+	 && f->fd >= 0) {
+		if (cob_iobuf_mapped (f)) {
+			cur = cob_iobuf_tell (f);
+		} else {
+			cur = lseek (f->fd, 0, SEEK_CUR);
+		}
+		if (cur > 0)
+			done += (cob_s64_t)cur;
+		*pos = done;
+	}
+	return total;
+}
+
 void
 cob_rewrite (cob_file *f, cob_field *rec, const int opt, cob_field *fnstatus)
 {
@@ -7151,7 +9304,10 @@ cob_commit (void)
 		if (l->file == NULL)
 			continue;
 		f = l->file;
-		if (f->flag_was_updated) {
+		if (cob_iobuf_flush (f)) {
+			/* Buffered data is lost: keep the file marked as updated,
+			   the error is returned by the next WRITE or the CLOSE */
+		} else if (f->flag_was_updated) {
 			if (f->flag_io_tran) {
 				f->last_operation = COB_LAST_COMMIT;
 				fileio_funcs[get_io_ptr (f)]->commit (&file_api, f);
@@ -7163,6 +9319,7 @@ cob_commit (void)
 		}
 		if (f->flag_close_pend) {	/* Close was pending commit/rollback */
 			f->flag_close_pend = 0;
+			f->flag_was_updated = 0;	/* else CLOSE is pended again */
 			if (f->tran_open_mode != COB_OPEN_CLOSED
 			 && f->open_mode == COB_OPEN_CLOSED) {
 				f->open_mode = f->tran_open_mode;
@@ -7196,6 +9353,8 @@ cob_rollback (void)
 		if (l->file == NULL)
 			continue;
 		f = l->file;
+		cob_iobuf_reset (f, -1);	/* Write pending data before ROLLBACK */
+		cob_relmap_free (f);		/* Rebuilt after ROLLBACK when needed */
 		if (f->flag_io_tran
 		 && f->flag_was_updated) {
 			f->last_operation = COB_LAST_ROLLBACK;
@@ -8048,6 +10207,84 @@ cob_sys_file_info (unsigned char *file_name, unsigned char *file_info)
 	return 0;
 }
 
+/*
+ * Size of the memory map of the open file 'f' (LMDB), the part of it
+ * in use and the size it may grow to; returns 1 if the I/O handler of
+ * the file has no map
+ */
+int
+cob_file_get_map_stats (cob_file *f, cob_file_map_stats *st)
+{
+	memset (st, 0, sizeof (cob_file_map_stats));
+	if (f == NULL
+	 || f->file == NULL
+	 || f->open_mode == COB_OPEN_CLOSED
+	 || f->open_mode == COB_OPEN_LOCKED
+	 || fileio_funcs[get_io_ptr (f)]->iomapinfo == NULL) {
+		return 1;
+	}
+	if (fileio_funcs[get_io_ptr (f)]->iomapinfo (&file_api, f,
+				&st->size, &st->used, &st->max)) {
+		memset (st, 0, sizeof (cob_file_map_stats));
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * CBL_GC_FILE_MAP_STATS: map of the open file with the given SELECT name
+ * as up to 4 unsigned 8-byte big-endian numbers: size, used, headroom
+ * and the size it may grow to
+ */
+int
+cob_sys_file_map_stats (unsigned char *select_name, unsigned char *data)
+{
+	struct file_list	*l;
+	cob_file_map_stats	st;
+	cob_u64_t	v[4];
+	char		*fn;
+	size_t		size;
+	int		i;
+	int		ret;
+
+	COB_UNUSED (select_name);
+
+	COB_CHK_PARMS (CBL_GC_FILE_MAP_STATS, 2);
+
+	if (cob_get_num_params () < 2
+	 || COB_MODULE_PTR->cob_procedure_params[1] == NULL) {
+		return 128;
+	}
+	fn = cob_param_no_quotes (1);
+	if (fn == NULL) {
+		return -1;
+	}
+	for (l = file_cache; l; l = l->next) {
+		if (l->file != NULL
+		 && l->file->select_name != NULL
+		 && strcasecmp (l->file->select_name, fn) == 0) {
+			break;
+		}
+	}
+	cob_free (fn);
+	ret = cob_file_get_map_stats (l != NULL ? l->file : NULL, &st);
+	v[0] = st.size;
+	v[1] = st.used;
+	v[2] = st.size - st.used;
+	v[3] = st.max;
+	size = COB_MODULE_PTR->cob_procedure_params[1]->size / 8;
+	if (size > 4) {
+		size = 4;
+	}
+	for (i = 0; i < (int)size; i++) {
+#ifndef	WORDS_BIGENDIAN
+		v[i] = COB_BSWAP_64 (v[i]);
+#endif
+		memcpy (data + i * 8, &v[i], (size_t)8);
+	}
+	return ret;
+}
+
 int
 cob_sys_file_delete (unsigned char *file_name, unsigned char *file_type)
 {
@@ -8099,255 +10336,1654 @@ sort_cmps (const unsigned char *s1, const unsigned char *s2, const size_t size,
 	return 0;
 }
 
-static COB_INLINE void
-unique_copy (unsigned char *s1, const unsigned char *s2)
+/*
+ * Memory of the SORT: with COB_SORT_MEMORY 'auto' (stored as 0) the limit
+ * is a share of the memory available to the process, within the limit of
+ * its control group, but not more than the records of the USING files
+ * need when their count is known; the chunks holding the records then
+ * double in size from COB_SORT_CHUNK up to COB_SORT_ARENA_MAX, chunks of
+ * COB_SORT_HUGE and more are mapped aligned for transparent huge pages
+ */
+
+#define COB_SORT_ARENA_MAX	(64 * 1024 * 1024)	/* Largest chunk */
+#define COB_SORT_HUGE		(2 * 1024 * 1024)	/* Huge page size */
+#define COB_SORT_AUTO_SHARE	4	/* 'auto' uses a quarter */
+#define COB_SORT_AUTO_MIN	(16 * 1024 * 1024)
+#define COB_SORT_AUTO_DFLT	(128 * 1024 * 1024)	/* Nothing found */
+
+#if defined (__linux__)
+/*
+ * Read a value in bytes from a file of /proc or /sys: the first number
+ * in the file, or the one after 'tag' given in kB; 0 if not found
+ */
+static cob_u64_t
+cob_sort_sys_value (const char *name, const char *tag)
 {
-	size_t	size;
+	FILE		*fp;
+	char		line[256];
+	cob_u64_t	val = 0;
+	size_t		len = tag ? strlen (tag) : 0;
 
-	size = sizeof (size_t);
-	do {
-		*s1++ = *s2++;
-	} while (--size);
+	fp = fopen (name, "r");
+	if (fp == NULL) {
+		return 0;
+	}
+	while (fgets (line, (int)sizeof (line), fp) != NULL) {
+		if (tag == NULL) {
+			if (isdigit ((unsigned char)line[0])) {
+				val = strtoull (line, NULL, 10);
+			}
+			break;
+		}
+		if (strncmp (line, tag, len) == 0) {
+			val = strtoull (line + len, NULL, 10) * 1024;
+			break;
+		}
+	}
+	fclose (fp);
+	return val;
 }
+#endif
 
-static int
-cob_file_sort_compare (struct cobitem *k1, struct cobitem *k2, void *pointer)
+/* Memory the process may still use, 0 if not known */
+static cob_u64_t
+cob_sort_mem_free (void)
 {
-	cob_file	*f;
-	int		i;
-	size_t		u1;
-	size_t		u2;
-	int		cmp;
-	cob_field	f1;
-	cob_field	f2;
+	cob_u64_t	avail = 0;
+#if defined (__linux__)
+	cob_u64_t	lim;
+	cob_u64_t	used;
+#endif
 
-	f = pointer;
-	for (i = 0; i < (int)f->nkeys; ++i) {
-		f1 = f2 = *(f->keys[i].field);
-		f1.data = k1->item + f->keys[i].offset;
-		f2.data = k2->item + f->keys[i].offset;
-		if (COB_FIELD_IS_NUMERIC (&f1)) {
-			cmp = cob_numeric_cmp (&f1, &f2);
-		} else {
-			cmp = sort_cmps (f1.data, f2.data, f1.size,
-					 f->sort_collating);
-		}
-		if (cmp != 0) {
-			return (f->keys[i].tf_ascending == COB_ASCENDING) ? cmp : -cmp;
+#if defined (_SC_PHYS_PAGES) && defined (_SC_PAGESIZE)
+	{
+		long	pages = sysconf (_SC_PHYS_PAGES);
+		long	psize = sysconf (_SC_PAGESIZE);
+		if (pages > 0 && psize > 0) {
+			avail = (cob_u64_t)pages * (cob_u64_t)psize;
 		}
 	}
-	unique_copy ((unsigned char *)&u1, k1->unique);
-	unique_copy ((unsigned char *)&u2, k2->unique);
-	if (u1 < u2) {
-		return -1;
+#endif
+#if defined (__linux__)
+	lim = cob_sort_sys_value ("/proc/meminfo", "MemAvailable:");
+	if (lim > 0 && (avail == 0 || lim < avail)) {
+		avail = lim;
+	}
+	/* Control group v2, then v1; 'max' means there is no limit */
+	lim = cob_sort_sys_value ("/sys/fs/cgroup/memory.max", NULL);
+	if (lim > 0) {
+		used = cob_sort_sys_value ("/sys/fs/cgroup/memory.current", NULL);
+	} else {
+		lim = cob_sort_sys_value ("/sys/fs/cgroup/memory/memory.limit_in_bytes", NULL);
+		used = cob_sort_sys_value ("/sys/fs/cgroup/memory/memory.usage_in_bytes", NULL);
 	}
-	return 1;
+	if (lim > 0) {
+		lim = lim > used ? lim - used : 0;
+		if (avail == 0 || lim < avail) {
+			avail = lim;
+		}
+	}
+#endif
+	return avail;
 }
 
+/* Set the memory limit, again when more USING files are known */
 static void
-cob_free_list (struct cobsort *hp)
+cob_sort_mem_setup (struct cobsort *hp)
 {
-	struct sort_mem_struct	*s1;
-	struct sort_mem_struct	*s2;
+	cob_u64_t	limit;
+	cob_u64_t	need;
 
-	s1 = hp->mem_base;
+	if (file_setptr->cob_sort_memory != 0) {
+		hp->mem_limit = file_setptr->cob_sort_memory;
+		return;
+	}
+	if (hp->mem_avail == 0) {
+		limit = cob_sort_mem_free ();
+		if (limit == 0) {
+			limit = COB_SORT_AUTO_DFLT;
+		} else {
+			limit /= COB_SORT_AUTO_SHARE;
+		}
+		if (limit < COB_SORT_AUTO_MIN) {
+			limit = COB_SORT_AUTO_MIN;
+		} else if (limit > (cob_u64_t)((size_t)-1 / 2)) {
+			limit = (size_t)-1 / 2;
+		}
+		hp->mem_avail = (size_t)limit;
+	}
+	hp->mem_limit = hp->mem_avail;
+	if (hp->mem_hint > 0) {
+		/* The entry array doubles and has a copy with threads */
+		need = (cob_u64_t)hp->mem_hint
+		     * (hp->alloc_size + 4 * sizeof (struct cob_sort_entry));
+		if (need < COB_SORT_AUTO_MIN) {
+			need = COB_SORT_AUTO_MIN;
+		}
+		if (need < hp->mem_limit) {
+			hp->mem_limit = (size_t)need;
+		}
+	}
+}
+
+/* Allocate a chunk of 'size' bytes, set 'size' to its usable size */
+static void
+cob_sort_chunk_alloc (struct sort_mem_struct *s, size_t size)
+{
+#if defined (COB_USE_MMAP) && defined (MAP_ANONYMOUS)
+	unsigned char	*p;
+	size_t		head;
+
+	if (size >= COB_SORT_HUGE) {
+		/* Map a huge page more, then unmap the unaligned ends */
+		size = (size + COB_SORT_HUGE - 1) & ~(size_t)(COB_SORT_HUGE - 1);
+		p = mmap (NULL, size + COB_SORT_HUGE, PROT_READ | PROT_WRITE,
+			  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p != MAP_FAILED) {
+			head = COB_SORT_HUGE - ((size_t)p & (COB_SORT_HUGE - 1));
+			if (head == COB_SORT_HUGE) {
+				head = 0;
+			}
+			if (head > 0) {
+				munmap (p, head);
+			}
+			munmap (p + head + size, COB_SORT_HUGE - head);
+			p += head;
+#if defined (HAVE_MADVISE) && defined (MADV_HUGEPAGE)
+			(void)madvise (p, size, MADV_HUGEPAGE);
+#endif
+			s->mem_ptr = p;
+			s->size = size;
+			s->map = 1;
+			return;
+		}
+	}
+#endif
+	s->mem_ptr = cob_fast_malloc (size);
+	s->size = size;
+	s->map = 0;
+}
+
+/*
+ * Sort keys are normalized at RELEASE, so that records compare with
+ * memcmp: the data of an item holds the normalized keys, the RELEASE
+ * sequence as COB_SORT_UNIQUE bytes big-endian and then the record;
+ * alphanumeric keys get the collating sequence applied, numeric keys are
+ * a sign byte followed by the magnitude big-endian, complemented if the
+ * value is negative, and DESCENDING keys are inverted;
+ * floating-point keys cannot be normalized as they compare with a
+ * tolerance, those and all following keys are compared field by field
+ * when the normalized part is equal
+ */
+
+#define COB_SORT_UNIQUE		8	/* Size of the RELEASE sequence */
+
+#define COB_SORT_KEY_ALNUM	0	/* Collating sequence applied */
+#define COB_SORT_KEY_BINARY	1	/* Up to 8 bytes */
+#define COB_SORT_KEY_DISPLAY	2	/* Unsigned, digits read directly */
+#define COB_SORT_KEY_DECIMAL	3	/* Through cob_decimal */
+
+/* Set the kind of the key, returns 0 if it cannot be normalized */
+static int
+cob_sort_key_kind (struct cob_sort_key *k)
+{
+	cob_field	*fld = &k->field;
+	size_t		digits;
+
+	switch (COB_FIELD_TYPE (fld)) {
+	case COB_TYPE_NUMERIC_BINARY:
+		if (fld->size > sizeof (cob_u64_t)) {
+			return 0;
+		}
+		k->kind = COB_SORT_KEY_BINARY;
+		k->width = (unsigned int)fld->size;
+		return 1;
+	case COB_TYPE_NUMERIC_DISPLAY:
+		k->kind = COB_FIELD_HAVE_SIGN (fld)
+			? COB_SORT_KEY_DECIMAL : COB_SORT_KEY_DISPLAY;
+		digits = COB_FIELD_SIZE (fld) + 1;
+		break;
+	case COB_TYPE_NUMERIC_PACKED:
+		k->kind = COB_SORT_KEY_DECIMAL;
+		digits = 2 * fld->size + 1;
+		break;
+	default:
+		if (COB_FIELD_IS_NUMERIC (fld)) {
+			return 0;
+		}
+		k->kind = COB_SORT_KEY_ALNUM;
+		k->width = (unsigned int)fld->size;
+		return 1;
+	}
+	/* Bytes for values up to 10 ** digits, log (10) / log (256) < 0.416 */
+	k->width = (unsigned int)(digits * 416 / 1000) + 1;
+	return 1;
+}
+
+/* Set up the normalized keys and the size of an item */
+static void
+cob_sort_keys_init (struct cobsort *hp)
+{
+	cob_file		*f = hp->pointer;
+	struct cob_sort_key	*k;
+	unsigned int		i;
+
+	hp->nkey = cob_malloc ((f->nkeys + 1) * sizeof (struct cob_sort_key));
+	hp->key_size = 0;
+	for (i = 0; i < f->nkeys; ++i) {
+		k = &hp->nkey[i];
+		k->field = *(f->keys[i].field);
+		k->offset = f->keys[i].offset;
+		k->desc = f->keys[i].tf_ascending != COB_ASCENDING;
+		if (!cob_sort_key_kind (k)) {
+			break;
+		}
+		if (k->kind == COB_SORT_KEY_ALNUM) {
+			hp->key_size += k->width;
+		} else {
+			hp->key_size += 1 + k->width;
+		}
+		if (k->kind >= COB_SORT_KEY_DISPLAY && !hp->use_dec) {
+			cob_decimal_init (&hp->dec);
+			hp->use_dec = 1;
+		}
+	}
+	hp->norm_keys = i;
+	hp->all_norm = i == f->nkeys;
+	hp->data_off = hp->key_size + COB_SORT_UNIQUE;
+	hp->cmp_size = hp->all_norm ? hp->data_off : hp->key_size;
+	hp->prefix_size = hp->cmp_size < sizeof (cob_u64_t)
+			? (unsigned int)hp->cmp_size : sizeof (cob_u64_t);
+	/* Numeric comparison uses static decimals, so no threads then */
+	if (!hp->all_norm) {
+		hp->threads = 1;
+	}
+	hp->r_size = hp->data_off + hp->size;
+	hp->alloc_size = offsetof (struct cobitem, data) + hp->r_size;
+	if (hp->alloc_size % sizeof (void *)) {
+		hp->alloc_size += sizeof (void *) - (hp->alloc_size % sizeof (void *));
+	}
+}
+
+/* Set up keys and memory, done at the first RELEASE */
+static void
+cob_sort_keys_setup (struct cobsort *hp)
+{
+	cob_sort_keys_init (hp);
+	hp->chunk_size = file_setptr->cob_sort_chunk;
+	if (hp->chunk_size % hp->alloc_size) {
+		hp->chunk_size += hp->alloc_size - (hp->chunk_size % hp->alloc_size);
+	}
+	cob_sort_mem_setup (hp);
+}
+
+/* Store sign byte and 'width' bytes of the magnitude */
+static unsigned char *
+cob_sort_norm_u64 (unsigned char *out, const unsigned int width,
+		   const int neg, cob_u64_t mag)
+{
+	unsigned int	i;
+
+	*out++ = neg ? 0 : 1;
+	for (i = width; i-- > 0;) {
+		out[i] = (unsigned char)(neg ? ~mag : mag);
+		mag >>= 8;
+	}
+	return out + width;
+}
+
+static unsigned char *
+cob_sort_norm_binary (const struct cob_sort_key *k, unsigned char *out)
+{
+	const unsigned char	*d = k->field.data;
+	const size_t	size = k->field.size;
+	cob_u64_t	v = 0;
+	size_t		i;
+	int		neg = 0;
+
+#ifndef WORDS_BIGENDIAN
+	if (!COB_FIELD_BINARY_SWAP (&k->field)) {
+		for (i = size; i-- > 0;) {
+			v = (v << 8) | d[i];
+		}
+	} else
+#endif
+	for (i = 0; i < size; ++i) {
+		v = (v << 8) | d[i];
+	}
+	if (COB_FIELD_HAVE_SIGN (&k->field)
+	 && ((v >> (8 * size - 1)) & 1)) {
+		if (size < sizeof (cob_u64_t)) {
+			v |= ~(cob_u64_t)0 << (8 * size);
+		}
+		v = ~v + 1;
+		neg = 1;
+	}
+	return cob_sort_norm_u64 (out, k->width, neg, v);
+}
+
+static unsigned char *
+cob_sort_norm_decimal (struct cobsort *hp, const struct cob_sort_key *k,
+		       unsigned char *out)
+{
+	const unsigned char	*d = k->field.data;
+	cob_u64_t	v = 0;
+	size_t		i;
+	size_t		n;
+	int		neg;
+
+	if (k->kind == COB_SORT_KEY_DISPLAY
+	 && k->field.size < 20) {
+		for (i = 0; i < k->field.size; ++i) {
+			if (d[i] < '0' || d[i] > '9') {
+				break;
+			}
+			v = v * 10 + COB_D2I (d[i]);
+		}
+		if (i == k->field.size) {
+			return cob_sort_norm_u64 (out, k->width, 0, v);
+		}
+	}
+	cob_decimal_set_field (&hp->dec, (cob_field *)&k->field);
+	neg = mpz_sgn (hp->dec.value) < 0;
+	*out++ = neg ? 0 : 1;
+	mpz_abs (hp->dec.value, hp->dec.value);
+	n = mpz_sizeinbase (hp->dec.value, 256);
+	if (mpz_sgn (hp->dec.value) == 0) {
+		memset (out, 0, k->width);
+	} else if (n > k->width) {
+		memset (out, 0xFF, k->width);
+	} else {
+		memset (out, 0, k->width - n);
+		mpz_export (out + k->width - n, NULL, 1, 1, 1, 0,
+			    hp->dec.value);
+	}
+	if (neg) {
+		for (i = 0; i < k->width; ++i) {
+			out[i] = (unsigned char)~out[i];
+		}
+	}
+	return out + k->width;
+}
+
+/* Fill the data of an item from record 'p' */
+static void
+cob_sort_fill (struct cobsort *hp, unsigned char *data,
+	       const unsigned char *p)
+{
+	const unsigned char	*col = ((cob_file *)hp->pointer)->sort_collating;
+	unsigned char		*rec = data + hp->data_off;
+	unsigned char		*out = data;
+	unsigned char		*start;
+	struct cob_sort_key	*k;
+	cob_u64_t		u;
+	unsigned int		i;
+	size_t			j;
+
+	memcpy (rec, p, hp->size);
+	for (i = 0; i < hp->norm_keys; ++i) {
+		k = &hp->nkey[i];
+		k->field.data = rec + k->offset;
+		start = out;
+		switch (k->kind) {
+		case COB_SORT_KEY_ALNUM:
+			if (col) {
+				for (j = 0; j < k->width; ++j) {
+					out[j] = col[k->field.data[j]];
+				}
+			} else {
+				memcpy (out, k->field.data, k->width);
+			}
+			out += k->width;
+			break;
+		case COB_SORT_KEY_BINARY:
+			out = cob_sort_norm_binary (k, out);
+			break;
+		default:
+			out = cob_sort_norm_decimal (hp, k, out);
+			break;
+		}
+		if (k->desc) {
+			for (; start < out; ++start) {
+				*start = (unsigned char)~*start;
+			}
+		}
+	}
+	u = (cob_u64_t)hp->unique++;
+	for (j = COB_SORT_UNIQUE; j-- > 0;) {
+		out[j] = (unsigned char)u;
+		u >>= 8;
+	}
+}
+
+/*
+ * Compare the keys that are not normalized, then the RELEASE sequence;
+ * 'k1' and 'k2' point to the data of the items
+ */
+static int
+cob_sort_cmp_keys (struct cobsort *hp, const unsigned char *k1,
+		   const unsigned char *k2)
+{
+	cob_file	*f = hp->pointer;
+	cob_file_key	*key;
+	unsigned int	i;
+	const unsigned char	*r1 = k1 + hp->data_off;
+	const unsigned char	*r2 = k2 + hp->data_off;
+	int		cmp;
+	cob_field	f1;
+	cob_field	f2;
+
+	for (i = hp->norm_keys; i < f->nkeys; ++i) {
+		key = &f->keys[i];
+		if (COB_FIELD_IS_NUMERIC (key->field)) {
+			f1 = f2 = *(key->field);
+			f1.data = (unsigned char *)r1 + key->offset;
+			f2.data = (unsigned char *)r2 + key->offset;
+			cmp = cob_numeric_cmp (&f1, &f2);
+		} else {
+			cmp = sort_cmps (r1 + key->offset, r2 + key->offset,
+					 key->field->size, f->sort_collating);
+		}
+		if (cmp != 0) {
+			return (key->tf_ascending == COB_ASCENDING) ? cmp : -cmp;
+		}
+	}
+	return memcmp (k1 + hp->key_size, k2 + hp->key_size, COB_SORT_UNIQUE);
+}
+
+/*
+ * In-memory phase: an array of (key prefix, item) entries is sorted;
+ * the prefix holds the leading bytes of the normalized keys, so most
+ * comparisons are done on it without touching the records
+ */
+
+#define COB_SORT_INSERTION	16	/* Insertion sort up to this size */
+
+static COB_INLINE cob_u64_t
+cob_sort_prefix (struct cobsort *hp, const unsigned char *data)
+{
+	cob_u64_t	v = 0;
+	unsigned int	i;
+
+	if (hp->prefix_size == 0) {
+		return 0;
+	}
+	for (i = 0; i < hp->prefix_size; ++i) {
+		v = (v << 8) | data[i];
+	}
+	return v << (8 * (8 - hp->prefix_size));
+}
+
+static COB_INLINE int
+cob_sort_entry_cmp (struct cobsort *hp, const struct cob_sort_entry *e1,
+		    const struct cob_sort_entry *e2)
+{
+	int	cmp;
+
+	if (e1->prefix != e2->prefix) {
+		return e1->prefix < e2->prefix ? -1 : 1;
+	}
+	cmp = memcmp (e1->rec + hp->prefix_size, e2->rec + hp->prefix_size,
+		      hp->cmp_size - hp->prefix_size);
+	if (cmp != 0 || hp->all_norm) {
+		return cmp;
+	}
+	return cob_sort_cmp_keys (hp, e1->rec, e2->rec);
+}
+
+static void
+cob_sort_heap_down (struct cobsort *hp, struct cob_sort_entry *e,
+		    size_t i, const size_t n)
+{
+	struct cob_sort_entry	t;
+	size_t			c;
+
+	t = e[i];
+	while ((c = 2 * i + 1) < n) {
+		if (c + 1 < n
+		 && cob_sort_entry_cmp (hp, &e[c], &e[c + 1]) < 0) {
+			c++;
+		}
+		if (cob_sort_entry_cmp (hp, &t, &e[c]) >= 0) {
+			break;
+		}
+		e[i] = e[c];
+		i = c;
+	}
+	e[i] = t;
+}
+
+/*
+ * Introsort: quicksort with median of three, heapsort when the
+ * partitioning degenerates, insertion sort for short ranges;
+ * entries never compare equal as the RELEASE sequence decides last
+ */
+static void
+cob_sort_entries (struct cobsort *hp, struct cob_sort_entry *e, size_t n,
+		  int depth)
+{
+	struct cob_sort_entry	t;
+	struct cob_sort_entry	pivot;
+	size_t			i;
+	size_t			j;
+
+#define COB_SORT_SWAP(a,b)	t = e[a]; e[a] = e[b]; e[b] = t
+	while (n > COB_SORT_INSERTION) {
+		if (depth-- <= 0) {
+			for (i = n / 2; i-- > 0;) {
+				cob_sort_heap_down (hp, e, i, n);
+			}
+			for (i = n - 1; i > 0; i--) {
+				COB_SORT_SWAP (0, i);
+				cob_sort_heap_down (hp, e, 0, i);
+			}
+			return;
+		}
+		j = n / 2;
+		if (cob_sort_entry_cmp (hp, &e[j], &e[0]) < 0) {
+			COB_SORT_SWAP (j, 0);
+		}
+		if (cob_sort_entry_cmp (hp, &e[n - 1], &e[j]) < 0) {
+			COB_SORT_SWAP (n - 1, j);
+			if (cob_sort_entry_cmp (hp, &e[j], &e[0]) < 0) {
+				COB_SORT_SWAP (j, 0);
+			}
+		}
+		pivot = e[j];
+		i = 0;
+		j = n - 1;
+		for (;;) {
+			while (cob_sort_entry_cmp (hp, &e[++i], &pivot) < 0);
+			while (cob_sort_entry_cmp (hp, &pivot, &e[--j]) < 0);
+			if (i >= j) {
+				break;
+			}
+			COB_SORT_SWAP (i, j);
+		}
+		/* Recurse into the smaller part, loop on the larger one */
+		if (i < n - i) {
+			cob_sort_entries (hp, e, i, depth);
+			e += i;
+			n -= i;
+		} else {
+			cob_sort_entries (hp, e + i, n - i, depth);
+			n = i;
+		}
+	}
+#undef COB_SORT_SWAP
+	for (i = 1; i < n; i++) {
+		t = e[i];
+		for (j = i; j > 0 && cob_sort_entry_cmp (hp, &t, &e[j - 1]) < 0; j--) {
+			e[j] = e[j - 1];
+		}
+		e[j] = t;
+	}
+}
+
+static int
+cob_sort_depth (size_t n)
+{
+	int	depth;
+
+	for (depth = 0; n > 1; n >>= 1) {
+		depth += 2;
+	}
+	return depth;
+}
+
+#ifdef COB_USE_SORT_THREADS
+/*
+ * Parallel sort: each thread sorts a slice of the entries, splitters
+ * taken from regular samples of the sorted slices then cut all slices
+ * into as many partitions, and each thread merges one partition from
+ * all slices into its place in the target array
+ */
+
+#define COB_SORT_THREADS_MAX	64
+#define COB_SORT_THREAD_MIN	4096	/* Minimum entries per thread */
+
+struct cob_sort_par {
+	struct cobsort		*hp;
+	struct cob_sort_entry	*in;
+	struct cob_sort_entry	*out;
+	unsigned int		nthreads;
+	size_t			slice[COB_SORT_THREADS_MAX + 1];
+	size_t			*cut;	/* Start of partition j in slice s
+					   at [j * nthreads + s] */
+};
+
+struct cob_sort_task {
+	struct cob_sort_par	*par;
+	unsigned int		idx;
+	int			merge;
+	pthread_t		tid;
+};
+
+struct cob_sort_cursor {
+	struct cob_sort_entry	*p;
+	struct cob_sort_entry	*end;
+};
+
+static void
+cob_sort_cursor_down (struct cobsort *hp, struct cob_sort_cursor *h,
+		      size_t i, const size_t n)
+{
+	struct cob_sort_cursor	t;
+	size_t			c;
+
+	t = h[i];
+	while ((c = 2 * i + 1) < n) {
+		if (c + 1 < n
+		 && cob_sort_entry_cmp (hp, h[c + 1].p, h[c].p) < 0) {
+			c++;
+		}
+		if (cob_sort_entry_cmp (hp, t.p, h[c].p) <= 0) {
+			break;
+		}
+		h[i] = h[c];
+		i = c;
+	}
+	h[i] = t;
+}
+
+static void
+cob_sort_merge_part (struct cob_sort_par *par, const unsigned int j)
+{
+	struct cob_sort_cursor	h[COB_SORT_THREADS_MAX];
+	struct cob_sort_entry	*out;
+	const size_t		*from = par->cut + j * par->nthreads;
+	const size_t		*to = from + par->nthreads;
+	size_t			n;
+	size_t			pos;
+	unsigned int		s;
+
+	n = pos = 0;
+	for (s = 0; s < par->nthreads; s++) {
+		pos += from[s] - par->slice[s];
+		if (from[s] < to[s]) {
+			h[n].p = par->in + from[s];
+			h[n].end = par->in + to[s];
+			n++;
+		}
+	}
+	for (s = (unsigned int)(n / 2); s-- > 0;) {
+		cob_sort_cursor_down (par->hp, h, s, n);
+	}
+	out = par->out + pos;
+	while (n > 0) {
+		*out++ = *h[0].p++;
+		if (h[0].p == h[0].end) {
+			h[0] = h[--n];
+		}
+		cob_sort_cursor_down (par->hp, h, 0, n);
+	}
+}
+
+static void *
+cob_sort_task_run (void *arg)
+{
+	struct cob_sort_task	*task = arg;
+	struct cob_sort_par	*par = task->par;
+	size_t			n;
+
+	if (task->merge) {
+		cob_sort_merge_part (par, task->idx);
+	} else {
+		n = par->slice[task->idx + 1] - par->slice[task->idx];
+		cob_sort_entries (par->hp, par->in + par->slice[task->idx], n,
+				  cob_sort_depth (n));
+	}
+	return NULL;
+}
+
+/* Run one task per thread, the first one in the current thread */
+static void
+cob_sort_run_tasks (struct cob_sort_par *par, struct cob_sort_task *task,
+		    const int merge)
+{
+	unsigned int	i;
+
+	for (i = 0; i < par->nthreads; i++) {
+		task[i].par = par;
+		task[i].idx = i;
+		task[i].merge = merge;
+	}
+	for (i = 1; i < par->nthreads; i++) {
+		if (pthread_create (&task[i].tid, NULL, cob_sort_task_run,
+				    &task[i]) != 0) {
+			task[i].par = NULL;
+			(void)cob_sort_task_run (&task[i]);
+		}
+	}
+	(void)cob_sort_task_run (&task[0]);
+	for (i = 1; i < par->nthreads; i++) {
+		if (task[i].par != NULL) {
+			pthread_join (task[i].tid, NULL);
+		}
+	}
+}
+
+/* First entry of the sorted range not before 'key' */
+static size_t
+cob_sort_lower_bound (struct cobsort *hp, const struct cob_sort_entry *e,
+		      size_t lo, size_t hi, const struct cob_sort_entry *key)
+{
+	size_t	mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (cob_sort_entry_cmp (hp, &e[mid], key) < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+static void
+cob_sort_parallel (struct cobsort *hp)
+{
+	struct cob_sort_par	par;
+	struct cob_sort_task	task[COB_SORT_THREADS_MAX];
+	struct cob_sort_entry	*sample;
+	struct cob_sort_entry	*t;
+	size_t			nsample;
+	size_t			len;
+	unsigned int		nt;
+	unsigned int		s;
+	unsigned int		j;
+
+	nt = hp->threads;
+	if (hp->entry_tmp_max < hp->entry_max) {
+		if (hp->entry_tmp) {
+			cob_free (hp->entry_tmp);
+		}
+		hp->entry_tmp = cob_fast_malloc (hp->entry_max
+					* sizeof (struct cob_sort_entry));
+		hp->entry_tmp_max = hp->entry_max;
+	}
+	par.hp = hp;
+	par.in = hp->entry;
+	par.out = hp->entry_tmp;
+	par.nthreads = nt;
+	for (s = 0; s <= nt; s++) {
+		par.slice[s] = hp->entry_count / nt * s;
+	}
+	par.slice[nt] = hp->entry_count;
+	cob_sort_run_tasks (&par, task, 0);
+
+	/* Splitters from nt - 1 regular samples of each slice */
+	nsample = (size_t)nt * (nt - 1);
+	sample = cob_malloc (nsample * sizeof (struct cob_sort_entry));
+	for (s = 0; s < nt; s++) {
+		len = par.slice[s + 1] - par.slice[s];
+		for (j = 1; j < nt; j++) {
+			sample[s * (nt - 1) + j - 1]
+				= par.in[par.slice[s] + len / nt * j];
+		}
+	}
+	cob_sort_entries (hp, sample, nsample, cob_sort_depth (nsample));
+	par.cut = cob_malloc (((size_t)nt + 1) * nt * sizeof (size_t));
+	for (s = 0; s < nt; s++) {
+		par.cut[s] = par.slice[s];
+		par.cut[(size_t)nt * nt + s] = par.slice[s + 1];
+		for (j = 1; j < nt; j++) {
+			par.cut[(size_t)j * nt + s] = cob_sort_lower_bound (hp,
+				par.in, par.slice[s], par.slice[s + 1],
+				&sample[(size_t)j * (nt - 1) - 1]);
+		}
+	}
+	cob_free (sample);
+	cob_sort_run_tasks (&par, task, 1);
+	cob_free (par.cut);
+
+	t = hp->entry;
+	hp->entry = hp->entry_tmp;
+	hp->entry_tmp = t;
+}
+#endif
+
+static void
+cob_sort_memory (struct cobsort *hp)
+{
+#ifdef COB_USE_SORT_THREADS
+	if (hp->threads > 1
+	 && hp->entry_count >= (size_t)COB_SORT_THREAD_MIN * hp->threads) {
+		cob_sort_parallel (hp);
+		return;
+	}
+#endif
+	cob_sort_entries (hp, hp->entry, hp->entry_count,
+			  cob_sort_depth (hp->entry_count));
+}
+
+static void
+cob_free_list (struct cobsort *hp)
+{
+	struct sort_mem_struct	*s1;
+	struct sort_mem_struct	*s2;
+
+	s1 = hp->mem_base;
 	for (; s1;) {
 		s2 = s1;
 		s1 = s1->next;
+#if defined (COB_USE_MMAP) && defined (MAP_ANONYMOUS)
+		if (s2->map) {
+			munmap (s2->mem_ptr, s2->size);
+		} else
+#endif
 		cob_free (s2->mem_ptr);
 		cob_free (s2);
 	}
 }
 
-static struct cobitem *
-cob_new_item (struct cobsort *hp, const size_t size)
+static struct cobitem *
+cob_new_item (struct cobsort *hp, const size_t size)
+{
+	struct cobitem		*q;
+	struct sort_mem_struct	*s;
+	size_t			want;
+	size_t			rest;
+
+	COB_UNUSED (size);
+
+	/* Creation of an empty item */
+	if (hp->empty != NULL) {
+		q = hp->empty;
+		hp->empty = q->next;
+	} else {
+		if ((hp->mem_used + hp->alloc_size) > hp->mem_size) {
+			/* The last chunk only gets what is left of the limit */
+			want = hp->chunk_size;
+			rest = hp->mem_limit - hp->mem_limit % hp->alloc_size;
+			if (rest > hp->mem_total + hp->alloc_size) {
+				rest -= hp->mem_total;
+				if (want > rest) {
+					want = rest;
+				}
+			}
+			s = cob_fast_malloc (sizeof (struct sort_mem_struct));
+			cob_sort_chunk_alloc (s, want);
+			s->next = hp->mem_base;
+			hp->mem_base = s;
+			hp->mem_size = s->size;
+			hp->mem_total += s->size;
+			hp->mem_used = 0;
+			if (file_setptr->cob_sort_memory == 0
+			 && hp->chunk_size < COB_SORT_ARENA_MAX) {
+				hp->chunk_size *= 2;
+			}
+		}
+		q = (struct cobitem *)(hp->mem_base->mem_ptr + hp->mem_used);
+		hp->mem_used += hp->alloc_size;
+	}
+	/* Memory is full when the next item would need another chunk */
+	if (hp->empty == NULL
+	 && (hp->mem_used + hp->alloc_size) > hp->mem_size
+	 && hp->mem_total + (hp->entry_max + hp->entry_tmp_max)
+				* sizeof (struct cob_sort_entry)
+			>= hp->mem_limit) {
+		hp->switch_to_file = 1;
+	}
+	q->run_bit = 0;
+	q->next = NULL;
+	return q;
+}
+
+FILE *
+cob_create_tmpfile (const char *ext)
+{
+	FILE		*fp;
+	char		*filename;
+	int		fd;
+
+	filename = cob_malloc ((size_t)COB_FILE_BUFF);
+	cob_temp_name (filename, ext);
+	cob_incr_temp_iteration ();
+	fd = open (filename,
+		    O_CREAT | O_TRUNC | O_RDWR | O_BINARY | COB_OPEN_TEMPORARY,
+		    COB_FILE_MODE);
+	if (fd < 0) {
+		cob_free (filename);
+		return NULL;
+	}
+	(void)unlink (filename);
+	fp = fdopen (fd, "w+b");
+	if (!fp) {
+		close (fd);
+	}
+	cob_free (filename);
+	return fp;
+}
+
+/*
+ * External phase: once the memory is full the records go to sorted runs
+ * in temporary files, written and read in large blocks; with one thread
+ * the runs are built by replacement selection, which makes them about
+ * twice as long as the memory, otherwise each filling of the memory is
+ * sorted in parallel and written as one run; all runs are then merged at
+ * once with a heap, more passes are only done if there are more runs than
+ * buffers of COB_SORT_BLOCK_MIN fitting into COB_SORT_MEMORY
+ *
+ * The work files have their own I/O: buffers, file offsets and lengths
+ * are aligned to COB_SORT_ALIGN, each run is padded to it, so that the
+ * files can be opened with O_DIRECT (COB_SORT_DIRECT); with a list of
+ * temporary directories in COB_TMPDIR or TMPDIR the runs go in turn to
+ * a file in each of them, a merge pass writes to a second set of files
+ *
+ * With COB_SORT_COMPRESS the runs are a sequence of frames, each holding
+ * the records of up to COB_SORT_ZFRAME bytes compressed as a whole and
+ * preceded by its compressed and original length (equal if stored as is)
+ */
+
+#define COB_SORT_BLOCK		(4 * 1024 * 1024)	/* Buffer for a run */
+#define COB_SORT_BLOCK_MIN	(64 * 1024)	/* Smallest buffer when merging */
+#define COB_SORT_ALIGN		4096	/* Alignment of buffers and blocks */
+#define COB_SORT_DIRS_MAX	32	/* Temporary directories used */
+#define COB_SORT_ZFRAME		(128 * 1024)	/* Records per compressed frame */
+#define COB_SORT_ZHEAD		(2 * sizeof (unsigned int))	/* Frame header */
+
+#define COB_SORT_ALIGNED(n)	\
+	(((n) + COB_SORT_ALIGN - 1) & ~((size_t)COB_SORT_ALIGN - 1))
+
+#define COB_SORT_ITEM(e)	\
+	((struct cobitem *)((e)->rec - offsetof (struct cobitem, data)))
+
+/* Allocate 'size' bytes aligned to COB_SORT_ALIGN, 'mem' is to be freed */
+static unsigned char *
+cob_sort_alloc (void **mem, const size_t size)
+{
+	unsigned char	*p;
+
+	*mem = cob_fast_malloc (size + COB_SORT_ALIGN);
+	p = *mem;
+	return p + (COB_SORT_ALIGN - (size_t)p % COB_SORT_ALIGN) % COB_SORT_ALIGN;
+}
+
+/* Open temporary file 'n' in its directory, if not done yet */
+static void
+cob_sort_tempfile (struct cobsort *hp, const int n)
+{
+	char	*filename;
+	int	flags;
+
+	if (hp->tmp_fd[n] >= 0) {
+		return;
+	}
+	filename = cob_malloc ((size_t)COB_FILE_BUFF);
+	cob_temp_name_dir (filename, (unsigned int)n % hp->ndirs);
+	cob_incr_temp_iteration ();
+	flags = O_CREAT | O_TRUNC | O_RDWR | O_BINARY | COB_OPEN_TEMPORARY;
+#ifdef O_DIRECT
+	if (file_setptr->cob_sort_direct) {
+		hp->tmp_fd[n] = open (filename, flags | O_DIRECT, COB_FILE_MODE);
+	}
+	/* Not all file systems support O_DIRECT */
+	if (hp->tmp_fd[n] < 0)
+#endif
+	hp->tmp_fd[n] = open (filename, flags, COB_FILE_MODE);
+	if (hp->tmp_fd[n] >= 0) {
+		(void)unlink (filename);
+	}
+	cob_free (filename);
+	if (hp->tmp_fd[n] < 0) {
+		cob_runtime_error (_("SORT is unable to acquire temporary file"));
+		cob_stop_run (1);
+	}
+}
+
+/* Write 'len' bytes of 'wbuf', a multiple of COB_SORT_ALIGN */
+static int
+cob_sort_write (struct cobsort *hp, const size_t len)
+{
+	const int	fd = hp->tmp_fd[hp->wfile];
+
+	/* LCOV_EXCL_START */
+	if (lseek (fd, hp->tmp_end[hp->wfile], SEEK_SET) == -1
+	 || write (fd, hp->wbuf, len) != (ssize_t)len) {
+		return 1;
+	}
+	/* LCOV_EXCL_STOP */
+	hp->tmp_end[hp->wfile] += (off_t)len;
+	hp->stats.temp_bytes += len;
+	return 0;
+}
+
+/* Write the aligned part of 'wbuf', keep the rest */
+static int
+cob_sort_flush (struct cobsort *hp)
+{
+	const size_t	len = hp->wlen - hp->wlen % COB_SORT_ALIGN;
+
+	if (len > 0) {
+		/* LCOV_EXCL_START */
+		if (cob_sort_write (hp, len)) {
+			return 1;
+		}
+		/* LCOV_EXCL_STOP */
+		hp->wlen -= len;
+		memmove (hp->wbuf, hp->wbuf + len, hp->wlen);
+	}
+	return 0;
+}
+
+/* Compression of the runs from COB_SORT_COMPRESS, as far as available */
+static unsigned int
+cob_sort_codec (void)
+{
+	switch (file_setptr->cob_sort_compress) {
+	case COB_COMPRESS_NONE:
+		return COB_COMPRESS_NONE;
+#if defined (HAVE_ZSTD)
+	case COB_COMPRESS_ZSTD:
+	case COB_COMPRESS_AUTO:
+		return COB_COMPRESS_ZSTD;
+#endif
+	default:
+#if defined (HAVE_ZLIB)
+		return COB_COMPRESS_GZIP;
+#else
+		return COB_COMPRESS_NONE;
+#endif
+	}
+}
+
+/* Compress 'len' bytes into 'out', returns 0 on failure */
+static size_t
+cob_sort_compress (struct cobsort *hp, unsigned char *out,
+		   const unsigned char *in, const size_t len)
+{
+#if defined (HAVE_ZSTD)
+	if (hp->zcodec == COB_COMPRESS_ZSTD) {
+		size_t	n = ZSTD_compress (out, hp->zbound, in, len, 1);
+		return ZSTD_isError (n) ? 0 : n;
+	}
+#endif
+#if defined (HAVE_ZLIB)
+	if (hp->zcodec == COB_COMPRESS_GZIP) {
+		uLongf	n = (uLongf)hp->zbound;
+		if (compress2 (out, &n, in, (uLong)len, Z_BEST_SPEED) == Z_OK) {
+			return (size_t)n;
+		}
+	}
+#endif
+	COB_UNUSED (hp);
+	COB_UNUSED (out);
+	COB_UNUSED (in);
+	COB_UNUSED (len);
+	return 0;
+}
+
+/* Decompress a frame into 'out', returns 0 on failure */
+static size_t
+cob_sort_decompress (struct cobsort *hp, unsigned char *out,
+		     const size_t size, const unsigned char *in, const size_t len)
+{
+#if defined (HAVE_ZSTD)
+	if (hp->zcodec == COB_COMPRESS_ZSTD) {
+		size_t	n = ZSTD_decompress (out, size, in, len);
+		return ZSTD_isError (n) ? 0 : n;
+	}
+#endif
+#if defined (HAVE_ZLIB)
+	if (hp->zcodec == COB_COMPRESS_GZIP) {
+		uLongf	n = (uLongf)size;
+		if (uncompress (out, &n, in, (uLong)len) == Z_OK) {
+			return (size_t)n;
+		}
+	}
+#endif
+	COB_UNUSED (hp);
+	COB_UNUSED (out);
+	COB_UNUSED (size);
+	COB_UNUSED (in);
+	COB_UNUSED (len);
+	return 0;
+}
+
+/* Add the records in 'zraw' as a frame to 'wbuf' */
+static int
+cob_sort_zput (struct cobsort *hp)
+{
+	unsigned int	head[2];
+	unsigned char	*out;
+	size_t		clen;
+
+	if (hp->wlen + COB_SORT_ZHEAD + hp->zbound > hp->wbuf_size
+	 && cob_sort_flush (hp)) {
+		return 1;
+	}
+	out = hp->wbuf + hp->wlen + COB_SORT_ZHEAD;
+	clen = cob_sort_compress (hp, out, hp->zraw, hp->zlen);
+	if (clen == 0 || clen >= hp->zlen) {
+		/* Not compressible: stored as is */
+		clen = hp->zlen;
+		memcpy (out, hp->zraw, clen);
+	}
+	head[0] = (unsigned int)clen;
+	head[1] = (unsigned int)hp->zlen;
+	memcpy (out - COB_SORT_ZHEAD, head, COB_SORT_ZHEAD);
+	hp->wlen += COB_SORT_ZHEAD + clen;
+	hp->run[hp->wrun].size += (cob_s64_t)(COB_SORT_ZHEAD + clen);
+	hp->zlen = 0;
+	return 0;
+}
+
+/* End of the run written: pad it and write all of 'wbuf' */
+static int
+cob_sort_run_end (struct cobsort *hp)
+{
+	size_t	len;
+
+	/* LCOV_EXCL_START */
+	if (hp->zlen > 0
+	 && cob_sort_zput (hp)) {
+		return 1;
+	}
+	/* LCOV_EXCL_STOP */
+	len = COB_SORT_ALIGNED (hp->wlen);
+	if (len > 0) {
+		memset (hp->wbuf + hp->wlen, 0, len - hp->wlen);
+		/* LCOV_EXCL_START */
+		if (cob_sort_write (hp, len)) {
+			return 1;
+		}
+		/* LCOV_EXCL_STOP */
+		hp->wlen = 0;
+	}
+	return 0;
+}
+
+/* Start run 'idx' in the next file of the set written */
+static int
+cob_sort_run_start (struct cobsort *hp, const size_t idx)
 {
-	struct cobitem		*q;
-	struct sort_mem_struct	*s;
+	/* LCOV_EXCL_START */
+	if (cob_sort_run_end (hp)) {
+		return 1;
+	}
+	/* LCOV_EXCL_STOP */
+	hp->wfile = (int)(hp->wset * hp->ndirs + idx % hp->ndirs);
+	cob_sort_tempfile (hp, hp->wfile);
+	hp->wrun = idx;
+	hp->run[idx].off = hp->tmp_end[hp->wfile];
+	hp->run[idx].count = 0;
+	hp->run[idx].size = 0;
+	hp->run[idx].file = hp->wfile;
+	return 0;
+}
 
-	COB_UNUSED (size);
+/* Start a new run */
+static int
+cob_sort_run_new (struct cobsort *hp)
+{
+	if (hp->run == NULL) {
+		hp->run_max = 64;
+		hp->run = cob_malloc (hp->run_max * sizeof (struct cob_sort_run));
+	} else if (hp->run_count == hp->run_max) {
+		hp->run = cob_realloc (hp->run,
+				hp->run_max * sizeof (struct cob_sort_run),
+				(hp->run_max + 64) * sizeof (struct cob_sort_run));
+		hp->run_max += 64;
+	}
+	return cob_sort_run_start (hp, hp->run_count++);
+}
 
-	/* Creation of an empty item */
-	if (hp->empty != NULL) {
-		q = hp->empty;
-		hp->empty = q->next;
-		q->block_byte = 0;
-		q->next = NULL;
-		q->end_of_block = 0;
-		return (void *)q;
-	}
-	if ((hp->mem_used + hp->alloc_size) > hp->mem_size) {
-		s = cob_fast_malloc (sizeof (struct sort_mem_struct));
-		s->mem_ptr = cob_fast_malloc (hp->chunk_size);
-		s->next = hp->mem_base;
-		hp->mem_base = s;
-		hp->mem_size = hp->chunk_size;
-		hp->mem_total += hp->chunk_size;
-		hp->mem_used = 0;
-	}
-	q = (struct cobitem *)(hp->mem_base->mem_ptr + hp->mem_used);
-	hp->mem_used += hp->alloc_size;
-	if (hp->mem_total >= file_setptr->cob_sort_memory) {
-		if ((hp->mem_used + hp->alloc_size) > hp->mem_size) {
-			hp->switch_to_file = 1;
+/* Add a record to the run written */
+static COB_INLINE int
+cob_sort_put (struct cobsort *hp, const unsigned char *rec)
+{
+	if (hp->zcodec != COB_COMPRESS_NONE) {
+		if (hp->zlen + hp->r_size > hp->zframe
+		 && cob_sort_zput (hp)) {
+			return 1;
 		}
+		memcpy (hp->zraw + hp->zlen, rec, hp->r_size);
+		hp->zlen += hp->r_size;
+		hp->run[hp->wrun].count++;
+		return 0;
 	}
-	q->block_byte = 0;
-	q->next = NULL;
-	q->end_of_block = 0;
-	return q;
+	if (hp->wlen + hp->r_size > hp->wbuf_size
+	 && cob_sort_flush (hp)) {
+		return 1;
+	}
+	memcpy (hp->wbuf + hp->wlen, rec, hp->r_size);
+	hp->wlen += hp->r_size;
+	hp->run[hp->wrun].count++;
+	hp->run[hp->wrun].size += (cob_s64_t)hp->r_size;
+	return 0;
 }
 
-FILE *
-cob_create_tmpfile (const char *ext)
+/* First spill: set up the temporary files */
+static int
+cob_sort_start_files (struct cobsort *hp)
 {
-	FILE		*fp;
-	char		*filename;
-	int		fd;
+	unsigned int	i;
 
-	filename = cob_malloc ((size_t)COB_FILE_BUFF);
-	cob_temp_name (filename, ext);
-	cob_incr_temp_iteration ();
-	fd = open (filename,
-		    O_CREAT | O_TRUNC | O_RDWR | O_BINARY | COB_OPEN_TEMPORARY,
-		    COB_FILE_MODE);
-	if (fd < 0) {
-		cob_free (filename);
-		return NULL;
+	hp->ndirs = cob_temp_dir_count ();
+	if (hp->ndirs > COB_SORT_DIRS_MAX) {
+		hp->ndirs = COB_SORT_DIRS_MAX;
 	}
-	(void)unlink (filename);
-	fp = fdopen (fd, "w+b");
-	if (!fp) {
-		close (fd);
+	hp->tmp_fd = cob_malloc (2 * hp->ndirs * sizeof (int));
+	hp->tmp_end = cob_malloc (2 * hp->ndirs * sizeof (off_t));
+	for (i = 0; i < 2 * hp->ndirs; ++i) {
+		hp->tmp_fd[i] = -1;
 	}
-	cob_free (filename);
-	return fp;
+	/* After a flush less than COB_SORT_ALIGN bytes stay in 'wbuf' */
+	hp->rpad = COB_SORT_ALIGNED (hp->r_size);
+	hp->wbuf_size = COB_SORT_BLOCK;
+	if (hp->wbuf_size < hp->rpad + COB_SORT_ALIGN) {
+		hp->wbuf_size = hp->rpad + COB_SORT_ALIGN;
+	}
+	hp->zcodec = cob_sort_codec ();
+	if (hp->zcodec != COB_COMPRESS_NONE) {
+		hp->zframe = COB_SORT_ZFRAME - COB_SORT_ZFRAME % hp->r_size;
+		if (hp->zframe < hp->r_size) {
+			hp->zframe = hp->r_size;
+		}
+#if defined (HAVE_ZSTD)
+		if (hp->zcodec == COB_COMPRESS_ZSTD) {
+			hp->zbound = ZSTD_compressBound (hp->zframe);
+		}
+#endif
+#if defined (HAVE_ZLIB)
+		if (hp->zcodec == COB_COMPRESS_GZIP) {
+			hp->zbound = compressBound ((uLong)hp->zframe);
+		}
+#endif
+		hp->zpad = COB_SORT_ALIGNED (COB_SORT_ZHEAD + hp->zbound);
+		if (hp->wbuf_size < hp->zpad + COB_SORT_ALIGN) {
+			hp->wbuf_size = hp->zpad + COB_SORT_ALIGN;
+		}
+		hp->zraw = cob_fast_malloc (hp->zframe);
+	}
+	hp->wbuf = cob_sort_alloc (&hp->wbuf_mem, hp->wbuf_size);
+	hp->files_used = 1;
+	hp->wset = 0;
+	return 0;
+}
+
+/* Write the sorted records in memory as one run */
+static int
+cob_sort_write_run (struct cobsort *hp)
+{
+	struct cobitem	*q;
+	size_t		i;
+
+	/* LCOV_EXCL_START */
+	if (cob_sort_run_new (hp)) {
+		return 1;
+	}
+	/* LCOV_EXCL_STOP */
+	for (i = 0; i < hp->entry_count; ++i) {
+		/* LCOV_EXCL_START */
+		if (cob_sort_put (hp, hp->entry[i].rec)) {
+			return 1;
+		}
+		/* LCOV_EXCL_STOP */
+		q = COB_SORT_ITEM (&hp->entry[i]);
+		q->next = hp->empty;
+		hp->empty = q;
+	}
+	hp->entry_count = 0;
+	return 0;
+}
+
+/* Records of the current run come before those of the next one */
+static COB_INLINE int
+cob_sort_select_cmp (struct cobsort *hp, const struct cob_sort_entry *e1,
+		     const struct cob_sort_entry *e2)
+{
+	int	n1 = COB_SORT_ITEM (e1)->run_bit != hp->run_bit;
+	int	n2 = COB_SORT_ITEM (e2)->run_bit != hp->run_bit;
+
+	if (n1 != n2) {
+		return n1 - n2;
+	}
+	return cob_sort_entry_cmp (hp, e1, e2);
+}
+
+static void
+cob_sort_select_down (struct cobsort *hp, size_t i)
+{
+	struct cob_sort_entry	*e = hp->entry;
+	struct cob_sort_entry	t;
+	const size_t		n = hp->entry_count;
+	size_t			c;
+
+	t = e[i];
+	while ((c = 2 * i + 1) < n) {
+		if (c + 1 < n
+		 && cob_sort_select_cmp (hp, &e[c + 1], &e[c]) < 0) {
+			c++;
+		}
+		if (cob_sort_select_cmp (hp, &t, &e[c]) <= 0) {
+			break;
+		}
+		e[i] = e[c];
+		i = c;
+	}
+	e[i] = t;
+}
+
+/* Write the smallest record, starting the next run if needed */
+static int
+cob_sort_select_put (struct cobsort *hp)
+{
+	if (COB_SORT_ITEM (&hp->entry[0])->run_bit != hp->run_bit) {
+		hp->run_bit ^= 1;
+		/* LCOV_EXCL_START */
+		if (cob_sort_run_new (hp)) {
+			return 1;
+		}
+		/* LCOV_EXCL_STOP */
+	}
+	return cob_sort_put (hp, hp->entry[0].rec);
 }
 
+/*
+ * Replacement selection: the records in memory form a heap, the smallest
+ * one of the current run goes to disk and the new record takes its place;
+ * if it sorts before the record written it is kept for the next run
+ */
 static int
-cob_get_sort_tempfile (struct cobsort *hp, const int n)
+cob_sort_select (struct cobsort *hp, const unsigned char *p)
 {
-	if (hp->file[n].fp == NULL) {
-		hp->file[n].fp = cob_create_tmpfile (NULL);
-		if (hp->file[n].fp == NULL) {
-			cob_runtime_error (_("SORT is unable to acquire temporary file"));
-			cob_stop_run (1);
+	struct cob_sort_entry	*e;
+	struct cob_sort_entry	n;
+	struct cobitem		*q;
+	size_t			i;
+
+	if (!hp->selecting) {
+		hp->selecting = 1;
+		hp->run_bit = 0;
+		hp->spare = cob_new_item (hp, hp->alloc_size);
+		for (i = hp->entry_count / 2; i-- > 0;) {
+			cob_sort_select_down (hp, i);
+		}
+		/* LCOV_EXCL_START */
+		if (cob_sort_run_new (hp)) {
+			return COBSORTFILEERR;
 		}
+		/* LCOV_EXCL_STOP */
+	}
+	/* LCOV_EXCL_START */
+	if (cob_sort_select_put (hp)) {
+		return COBSORTFILEERR;
+	}
+	/* LCOV_EXCL_STOP */
+	e = &hp->entry[0];
+	q = hp->spare;
+	cob_sort_fill (hp, q->data, p);
+	n.rec = q->data;
+	n.prefix = cob_sort_prefix (hp, q->data);
+	if (cob_sort_entry_cmp (hp, &n, e) < 0) {
+		q->run_bit = (unsigned char)(hp->run_bit ^ 1);
 	} else {
-		rewind (hp->file[n].fp);
+		q->run_bit = (unsigned char)hp->run_bit;
+	}
+	hp->spare = COB_SORT_ITEM (e);
+	*e = n;
+	cob_sort_select_down (hp, 0);
+	return 0;
+}
+
+/* End of input: write out the heap */
+static int
+cob_sort_select_drain (struct cobsort *hp)
+{
+	while (hp->entry_count > 0) {
+		/* LCOV_EXCL_START */
+		if (cob_sort_select_put (hp)) {
+			return 1;
+		}
+		/* LCOV_EXCL_STOP */
+		hp->entry[0] = hp->entry[--hp->entry_count];
+		cob_sort_select_down (hp, 0);
 	}
-	hp->file[n].count = 0;
-	return hp->file[n].fp == NULL;
+	hp->selecting = 0;
+	return 0;
 }
 
+/*
+ * Read the next block of a run behind the first 'pad' bytes of 'buf',
+ * the data from '*pos' to '*len' not used yet is moved before it
+ */
 static int
-cob_sort_queues (struct cobsort *hp)
+cob_sort_read_block (struct cobsort *hp, struct cob_sort_reader *r,
+		     unsigned char *buf, const size_t pad,
+		     size_t *pos, size_t *len)
 {
-	struct cobitem	*q;
-	int		source;
-	int		destination;
-	int		move;
-	int		n;
-	int		end_of_block[2];
-
-	source = 0;
-	while (hp->queue[source + 1].count != 0) {
-		destination = source ^ 2;
-		hp->queue[destination].first = NULL;
-		hp->queue[destination].count = 0;
-		hp->queue[destination + 1].first = NULL;
-		hp->queue[destination + 1].count = 0;
+	const size_t	tail = *len - *pos;
+	size_t		n;
+
+	memmove (buf + pad - tail, buf + *pos, tail);
+	n = hp->block;
+	if ((cob_s64_t)n > r->rest) {
+		n = COB_SORT_ALIGNED ((size_t)r->rest);
+	}
+	/* LCOV_EXCL_START */
+	if (lseek (r->fd, r->off, SEEK_SET) == -1
+	 || read (r->fd, buf + pad, n) != (ssize_t)n) {
+		return 1;
+	}
+	/* LCOV_EXCL_STOP */
+	r->off += (off_t)n;
+	if ((cob_s64_t)n > r->rest) {
+		n = (size_t)r->rest;
+	}
+	r->rest -= (cob_s64_t)n;
+	*pos = pad - tail;
+	*len = pad + n;
+	return 0;
+}
+
+/* Get the next records of a run into the buffer of the reader */
+static int
+cob_sort_read (struct cobsort *hp, struct cob_sort_reader *r)
+{
+	unsigned int	head[2];
+	size_t		avail;
+
+	if (hp->zcodec == COB_COMPRESS_NONE) {
+		/* LCOV_EXCL_START */
+		if (cob_sort_read_block (hp, r, r->buf, hp->rpad,
+					 &r->pos, &r->len)) {
+			return 1;
+		}
+		/* LCOV_EXCL_STOP */
+	} else {
+		/* Decompress the next frame */
 		for (;;) {
-			end_of_block[0] = hp->queue[source].count == 0;
-			end_of_block[1] = hp->queue[source + 1].count == 0;
-			if (end_of_block[0] && end_of_block[1]) {
-				break;
-			}
-			while (!end_of_block[0] || !end_of_block[1]) {
-				if (end_of_block[0]) {
-					move = 1;
-				} else if (end_of_block[1]) {
-					move = 0;
-				} else {
-					n = cob_file_sort_compare
-						(hp->queue[source].first,
-						hp->queue[source + 1].first,
-						hp->pointer);
-					move = n < 0 ? 0 : 1;
-				}
-				q = hp->queue[source + move].first;
-				if (q->end_of_block) {
-					end_of_block[move] = 1;
-				}
-				hp->queue[source + move].first = q->next;
-				if (hp->queue[destination].first == NULL) {
-					hp->queue[destination].first = q;
-				} else {
-					hp->queue[destination].last->next = q;
+			avail = r->zlen - r->zpos;
+			if (avail >= COB_SORT_ZHEAD) {
+				memcpy (head, r->zbuf + r->zpos, COB_SORT_ZHEAD);
+				if (avail >= COB_SORT_ZHEAD + head[0]) {
+					break;
 				}
-				hp->queue[destination].last = q;
-				hp->queue[source + move].count--;
-				hp->queue[destination].count++;
-				q->next = NULL;
-				q->end_of_block = 0;
 			}
-			hp->queue[destination].last->end_of_block = 1;
-			destination ^= 1;
+			/* LCOV_EXCL_START */
+			if (r->rest == 0
+			 || cob_sort_read_block (hp, r, r->zbuf, hp->zpad,
+						 &r->zpos, &r->zlen)) {
+				return 1;
+			}
+			/* LCOV_EXCL_STOP */
+		}
+		r->zpos += COB_SORT_ZHEAD;
+		if (head[0] == head[1]) {
+			memcpy (r->buf, r->zbuf + r->zpos, head[1]);
+		/* LCOV_EXCL_START */
+		} else if (cob_sort_decompress (hp, r->buf, hp->zframe,
+				r->zbuf + r->zpos, head[0]) != head[1]) {
+			return 1;
+		}
+		/* LCOV_EXCL_STOP */
+		r->zpos += head[0];
+		r->pos = 0;
+		r->len = head[1];
+	}
+	r->cur.rec = r->buf + r->pos;
+	r->cur.prefix = cob_sort_prefix (hp, r->cur.rec);
+	return 0;
+}
+
+static void
+cob_sort_reader_down (struct cobsort *hp, size_t i)
+{
+	struct cob_sort_reader	**h = hp->heap;
+	struct cob_sort_reader	*t;
+	const size_t		n = hp->nreaders;
+	size_t			c;
+
+	t = h[i];
+	while ((c = 2 * i + 1) < n) {
+		if (c + 1 < n
+		 && cob_sort_entry_cmp (hp, &h[c + 1]->cur, &h[c]->cur) < 0) {
+			c++;
+		}
+		if (cob_sort_entry_cmp (hp, &t->cur, &h[c]->cur) <= 0) {
+			break;
 		}
-		source = destination & 2;
+		h[i] = h[c];
+		i = c;
 	}
-	return source;
+	h[i] = t;
 }
 
+/* Set up readers for 'n' runs from 'first' on */
 static int
-cob_read_item (struct cobsort *hp, const int n)
+cob_sort_merge_open (struct cobsort *hp, const size_t first, const size_t n)
 {
-	FILE	*fp;
+	struct cob_sort_reader	*r;
+	size_t			i;
+	size_t			rsize;
+	size_t			size;
 
-	fp = hp->file[n].fp;
-	if (getc (fp) != 0) {
-		hp->queue[n].first->end_of_block = 1;
+	if (hp->reader) {
+		cob_free (hp->reader);
+		cob_free (hp->heap);
+		cob_free (hp->rbuf_mem);
+	}
+	hp->block = hp->mem_limit / n;
+	if (hp->block > COB_SORT_BLOCK) {
+		hp->block = COB_SORT_BLOCK;
+	} else if (hp->block < COB_SORT_BLOCK_MIN) {
+		hp->block = COB_SORT_BLOCK_MIN;
+	}
+	hp->block -= hp->block % COB_SORT_ALIGN;
+	if (hp->block < hp->rpad) {
+		hp->block = hp->rpad;
+	}
+	/* Records of a frame, then the compressed data */
+	if (hp->zcodec != COB_COMPRESS_NONE) {
+		rsize = COB_SORT_ALIGNED (hp->zframe);
+		size = rsize + hp->zpad + hp->block;
 	} else {
-		hp->queue[n].first->end_of_block = 0;
+		rsize = 0;
+		size = hp->rpad + hp->block;
+	}
+	hp->reader = cob_malloc (n * sizeof (struct cob_sort_reader));
+	hp->heap = cob_malloc (n * sizeof (struct cob_sort_reader *));
+	hp->rbuf = cob_sort_alloc (&hp->rbuf_mem, n * size);
+	hp->nreaders = 0;
+	for (i = 0; i < n; i++) {
+		r = &hp->reader[i];
+		r->buf = hp->rbuf + i * size;
+		r->zbuf = r->buf + rsize;
+		r->zpos = r->zlen = hp->zpad;
+		r->fd = hp->tmp_fd[hp->run[first + i].file];
+		r->off = hp->run[first + i].off;
+		r->rest = hp->run[first + i].size;
+		r->pos = r->len = hp->rpad;
+		if (hp->run[first + i].count == 0) {
+			continue;
+		}
 		/* LCOV_EXCL_START */
-		if (fread (hp->queue[n].first->unique,
-				hp->r_size, (size_t)1, fp) != 1) {
+		if (cob_sort_read (hp, r)) {
 			return 1;
 		}
 		/* LCOV_EXCL_STOP */
+		hp->heap[hp->nreaders++] = r;
+	}
+	for (i = hp->nreaders / 2; i-- > 0;) {
+		cob_sort_reader_down (hp, i);
 	}
 	return 0;
 }
 
+/* Step past the smallest record */
 static int
-cob_write_block (struct cobsort *hp, const int n)
+cob_sort_merge_next (struct cobsort *hp)
 {
-	struct cobitem	*q;
-	FILE		*fp;
+	struct cob_sort_reader	*r = hp->heap[0];
 
-	fp = hp->file[hp->destination_file].fp;
-	for (;;) {
-		q = hp->queue[n].first;
-		if (q == NULL) {
-			break;
+	r->pos += hp->r_size;
+	if (r->pos + hp->r_size <= r->len) {
+		r->cur.rec = r->buf + r->pos;
+		r->cur.prefix = cob_sort_prefix (hp, r->cur.rec);
+	} else if (r->rest > 0 || r->zpos < r->zlen) {
+		/* LCOV_EXCL_START */
+		if (cob_sort_read (hp, r)) {
+			return 1;
+		}
+		/* LCOV_EXCL_STOP */
+	} else {
+		hp->heap[0] = hp->heap[--hp->nreaders];
+	}
+	if (hp->nreaders > 1) {
+		cob_sort_reader_down (hp, 0);
+	}
+	return 0;
+}
+
+/* Merge groups of 'fanin' runs into single runs in the other set of files */
+static int
+cob_sort_merge_pass (struct cobsort *hp, const size_t fanin)
+{
+	size_t		first;
+	size_t		n;
+	size_t		out;
+	unsigned int	i;
+
+	hp->stats.passes++;
+	hp->wset ^= 1;
+	for (i = 0; i < hp->ndirs; ++i) {
+		hp->tmp_end[hp->wset * hp->ndirs + i] = 0;
+	}
+	out = 0;
+	for (first = 0; first < hp->run_count; first += n) {
+		n = hp->run_count - first;
+		if (n > fanin) {
+			n = fanin;
 		}
 		/* LCOV_EXCL_START */
-		if (fwrite (&(q->block_byte),
-				hp->w_size, (size_t)1, fp) != 1) {
+		if (cob_sort_merge_open (hp, first, n)) {
 			return 1;
 		}
 		/* LCOV_EXCL_STOP */
-		hp->queue[n].first = q->next;
-		q->next = hp->empty;
-		hp->empty = q;
+		/* The runs just opened are no longer needed in 'run' */
+		/* LCOV_EXCL_START */
+		if (cob_sort_run_start (hp, out++)) {
+			return 1;
+		}
+		/* LCOV_EXCL_STOP */
+		while (hp->nreaders > 0) {
+			/* LCOV_EXCL_START */
+			if (cob_sort_put (hp, hp->heap[0]->cur.rec)
+			 || cob_sort_merge_next (hp)) {
+				return 1;
+			}
+			/* LCOV_EXCL_STOP */
+		}
 	}
-	hp->queue[n].count = 0;
-	hp->file[hp->destination_file].count++;
 	/* LCOV_EXCL_START */
-	if (putc (1, fp) != 1) {
+	if (cob_sort_run_end (hp)) {
 		return 1;
 	}
 	/* LCOV_EXCL_STOP */
+	hp->run_count = out;
 	return 0;
 }
 
@@ -8374,113 +12010,56 @@ cob_copy_check (cob_file *to, cob_file *from)
 static int
 cob_file_sort_process (struct cobsort *hp)
 {
-	int	i;
-	int	source;
-	int	destination;
-	int	n;
-	int	move;
-	int	res;
+	size_t	fanin;
 
 	hp->retrieving = 1;
-	n = cob_sort_queues (hp);
-#if	0	/* RXWRXW - Cannot be true */
-	/* LCOV_EXCL_START */
-	if (n < 0) {
-		return COBSORTABORT;
-	}
-	/* LCOV_EXCL_STOP */
-#endif
+	hp->stats.memory = hp->mem_total + (hp->entry_max + hp->entry_tmp_max)
+			 * sizeof (struct cob_sort_entry);
 	if (!hp->files_used) {
-		hp->retrieval_queue = n;
+		cob_sort_memory (hp);
+		hp->entry_next = 0;
 		return 0;
 	}
-	/* LCOV_EXCL_START */
-	if (cob_write_block (hp, n)) {
-		return COBSORTFILEERR;
-	}
-	/* LCOV_EXCL_STOP */
-	for (i = 0; i < 4; ++i) {
-		hp->queue[i].first = hp->empty;
-		hp->empty = hp->empty->next;
-		hp->queue[i].first->next = NULL;
+	/* The rest of the records in memory go to disk too */
+	if (hp->selecting) {
+		/* LCOV_EXCL_START */
+		if (cob_sort_select_drain (hp)) {
+			return COBSORTFILEERR;
+		}
+		/* LCOV_EXCL_STOP */
+	} else if (hp->entry_count > 0) {
+		cob_sort_memory (hp);
+		/* LCOV_EXCL_START */
+		if (cob_sort_write_run (hp)) {
+			return COBSORTFILEERR;
+		}
+		/* LCOV_EXCL_STOP */
 	}
-	rewind (hp->file[0].fp);
-	rewind (hp->file[1].fp);
 	/* LCOV_EXCL_START */
-	if (cob_get_sort_tempfile (hp, 2)) {
-		return COBSORTFILEERR;
-	}
-	if (cob_get_sort_tempfile (hp, 3)) {
+	if (cob_sort_run_end (hp)) {
 		return COBSORTFILEERR;
 	}
 	/* LCOV_EXCL_STOP */
-	source = 0;
-	while (hp->file[source].count > 1) {
-		destination = source ^ 2;
-		hp->file[destination].count = 0;
-		hp->file[destination + 1].count = 0;
-		while (hp->file[source].count > 0) {
-			/* LCOV_EXCL_START */
-			if (cob_read_item (hp, source)) {
-				return COBSORTFILEERR;
-			}
-			/* LCOV_EXCL_STOP */
-			if (hp->file[source + 1].count > 0) {
-				/* LCOV_EXCL_START */
-				if (cob_read_item (hp, source + 1)) {
-					return COBSORTFILEERR;
-				}
-				/* LCOV_EXCL_STOP */
-			} else {
-				hp->queue[source + 1].first->end_of_block = 1;
-			}
-			while (!hp->queue[source].first->end_of_block ||
-			       !hp->queue[source + 1].first->end_of_block) {
-				if (hp->queue[source].first->end_of_block) {
-					move = 1;
-				} else if (hp->queue[source + 1].first->end_of_block) {
-					move = 0;
-				} else {
-					res = cob_file_sort_compare
-						(hp->queue[source].first,
-						hp->queue[source + 1].first,
-						hp->pointer);
-					move = res < 0 ? 0 : 1;
-				}
-				/* LCOV_EXCL_START */
-				if (fwrite (
-				    &(hp->queue[source + move].first->block_byte),
-				    hp->w_size, (size_t)1,
-				    hp->file[destination].fp) != 1) {
-					return COBSORTFILEERR;
-				}
-				if (cob_read_item (hp, source + move)) {
-					return COBSORTFILEERR;
-				}
-				/* LCOV_EXCL_STOP */
-			}
-			hp->file[destination].count++;
-			/* LCOV_EXCL_START */
-			if (putc (1, hp->file[destination].fp) != 1) {
-				return COBSORTFILEERR;
-			}
-			/* LCOV_EXCL_STOP */
-			hp->file[source].count--;
-			hp->file[source + 1].count--;
-			destination ^= 1;
+	cob_free_list (hp);
+	hp->mem_base = NULL;
+	hp->empty = NULL;
+	cob_free (hp->entry);
+	hp->entry = NULL;
+	hp->entry_count = hp->entry_max = 0;
+
+	/* Merge passes only while the runs don't fit into memory */
+	hp->stats.runs = hp->run_count;
+	hp->stats.passes = 1;
+	fanin = hp->mem_limit / COB_SORT_BLOCK_MIN;
+	while (hp->run_count > fanin) {
+		/* LCOV_EXCL_START */
+		if (cob_sort_merge_pass (hp, fanin)) {
+			return COBSORTFILEERR;
 		}
-		source = destination & 2;
-		rewind (hp->file[0].fp);
-		rewind (hp->file[1].fp);
-		rewind (hp->file[2].fp);
-		rewind (hp->file[3].fp);
+		/* LCOV_EXCL_STOP */
 	}
-	hp->retrieval_queue = source;
 	/* LCOV_EXCL_START */
-	if (cob_read_item (hp, source)) {
-		return COBSORTFILEERR;
-	}
-	if (cob_read_item (hp, source + 1)) {
+	if (cob_sort_merge_open (hp, 0, hp->run_count)) {
 		return COBSORTFILEERR;
 	}
 	/* LCOV_EXCL_STOP */
@@ -8492,8 +12071,7 @@ cob_file_sort_submit (cob_file *f, const unsigned char *p)
 {
 	struct cobsort		*hp;
 	struct cobitem		*q;
-	struct queue_struct	*z;
-	int			n;
+	struct cob_sort_entry	*e;
 
 	hp = f->file;
 	if (!hp) {
@@ -8502,47 +12080,254 @@ cob_file_sort_submit (cob_file *f, const unsigned char *p)
 	if (hp->retrieving) {
 		return COBSORTABORT;
 	}
+	hp->stats.records_in++;
+	if (hp->nkey == NULL) {
+		cob_sort_keys_setup (hp);
+	}
 	if (hp->switch_to_file) {
-		if (!hp->files_used) {
-			/* LCOV_EXCL_START */
-			if (cob_get_sort_tempfile (hp, 0)) {
-				return COBSORTFILEERR;
-			}
-			if (cob_get_sort_tempfile (hp, 1)) {
-				return COBSORTFILEERR;
-			}
-			/* LCOV_EXCL_STOP */
-			hp->files_used = 1;
-			hp->destination_file = 0;
-		}
-		n = cob_sort_queues (hp);
-#if	0	/* RXWRXW - Cannot be true */
 		/* LCOV_EXCL_START */
-		if (n < 0) {
-			return COBSORTABORT;
+		if (!hp->files_used
+		 && cob_sort_start_files (hp)) {
+			return COBSORTFILEERR;
 		}
 		/* LCOV_EXCL_STOP */
-#endif
+		if (hp->threads == 1) {
+			return cob_sort_select (hp, p);
+		}
+		cob_sort_memory (hp);
 		/* LCOV_EXCL_START */
-		if (cob_write_block (hp, n)) {
+		if (cob_sort_write_run (hp)) {
 			return COBSORTFILEERR;
 		}
 		/* LCOV_EXCL_STOP */
-		hp->destination_file ^= 1;
-	}
-	q = cob_new_item (hp, sizeof (struct cobitem) + hp->size);
-	q->end_of_block = 1;
-	unique_copy (q->unique, (const unsigned char *)&(hp->unique));
-	hp->unique++;
-	memcpy (q->item, p, hp->size);
-	if (hp->queue[0].count <= hp->queue[1].count) {
-		z = &hp->queue[0];
+		hp->switch_to_file = 0;
+	}
+	if (hp->entry_count == hp->entry_max) {
+		hp->entry = cob_realloc (hp->entry,
+				hp->entry_max * sizeof (struct cob_sort_entry),
+				hp->entry_max * 2 * sizeof (struct cob_sort_entry));
+		hp->entry_max *= 2;
+	}
+	q = cob_new_item (hp, hp->alloc_size);
+	cob_sort_fill (hp, q->data, p);
+	e = &hp->entry[hp->entry_count++];
+	e->prefix = cob_sort_prefix (hp, q->data);
+	e->rec = q->data;
+	return 0;
+}
+
+/*
+ * SORT statistics: counts and the elapsed and CPU time of the phases
+ * input (up to the first RETURN), sort (up to the final merge) and
+ * output; on close they are kept for cob_sort_get_stats and
+ * CBL_GC_SORT_STATS and written to COB_SORT_STATS if set
+ */
+
+/* Elapsed and CPU time of the process in microseconds */
+static void
+cob_sort_clock (cob_s64_t *wall, cob_s64_t *cpu)
+{
+#if defined (HAVE_CLOCK_GETTIME)
+	struct timespec	ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	*wall = (cob_s64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#if defined (CLOCK_PROCESS_CPUTIME_ID)
+	clock_gettime (CLOCK_PROCESS_CPUTIME_ID, &ts);
+	*cpu = (cob_s64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+	return;
+#endif
+#else
+	*wall = (cob_s64_t)time (NULL) * 1000000;
+#endif
+	*cpu = (cob_s64_t)clock () * 1000000 / CLOCKS_PER_SEC;
+}
+
+/* End the phase timed and start phase 'next' */
+static void
+cob_sort_phase (struct cobsort *hp, const unsigned int next)
+{
+	cob_s64_t	wall;
+	cob_s64_t	cpu;
+
+	cob_sort_clock (&wall, &cpu);
+	if (hp->phase < 3) {
+		hp->stats.wall[hp->phase] += wall - hp->phase_wall;
+		hp->stats.cpu[hp->phase] += cpu - hp->phase_cpu;
+	}
+	hp->phase = next;
+	hp->phase_wall = wall;
+	hp->phase_cpu = cpu;
+}
+
+/* Append a line for the SORT to COB_SORT_STATS */
+static void
+cob_sort_stats_write (cob_file *f, const cob_sort_stats *st)
+{
+	FILE		*fo;
+	struct stat	sb;
+	struct cob_time	tod;
+	int		k;
+
+	if (stat (file_setptr->cob_sort_stats, &sb) == -1) {
+		fo = fopen (file_setptr->cob_sort_stats, "w");
+		if (fo) {
+			fprintf (fo, "%19s,", "Time");
+			fprintf (fo, "%s", " Source, SDSelect, RecordsIn, RecordsOut,"
+				" Bytes, Memory, Runs, Passes, TempBytes,"
+				" InputWall, InputCPU, SortWall, SortCPU,"
+				" OutputWall, OutputCPU\n");
+			fclose (fo);
+		}
+	}
+	fo = fopen (file_setptr->cob_sort_stats, "a");
+	if (fo == NULL) {
+		return;
+	}
+	tod = cob_get_current_date_and_time ();
+	fprintf (fo, "%04d/%02d/%02d %02d:%02d:%02d,",
+		 tod.year, tod.month, tod.day_of_month,
+		 tod.hour, tod.minute, tod.second);
+	if (COB_MODULE_PTR
+	 && COB_MODULE_PTR->module_source) {
+		fprintf (fo, "%s", COB_MODULE_PTR->module_source);
 	} else {
-		z = &hp->queue[1];
+		fprintf (fo, "%s", "unknown");
+	}
+	fprintf (fo, ",%s, " CB_FMT_LLD "," CB_FMT_LLD "," CB_FMT_LLD
+		 "," CB_FMT_LLD "," CB_FMT_LLD "," CB_FMT_LLD "," CB_FMT_LLD,
+		 f->select_name ? f->select_name : "",
+		 st->records_in, st->records_out, st->bytes, st->memory,
+		 st->runs, st->passes, st->temp_bytes);
+	for (k = 0; k < 3; k++) {
+		fprintf (fo, "," CB_FMT_LLD "," CB_FMT_LLD,
+			 st->wall[k], st->cpu[k]);
+	}
+	fprintf (fo, "\n");
+	fclose (fo);
+}
+
+/*
+ * MERGE: the USING files are in order already, so instead of being
+ * sorted they are merged while they are read, by a heap over the current
+ * record of each file; no memory for the records and no temporary files
+ * are needed; a reader's buffer holds two records, the current one and
+ * the one before; a record lower than the one before it in the same
+ * file ends the MERGE with status 21, unless COB_MERGE_CHECK is off
+ */
+
+/*
+ * Read the next record of the file of reader 'r' (its 'fd' is the index
+ * in 'merge_file'), returns 1 if read, 0 at its end, -1 if out of sequence
+ */
+static int
+cob_sort_merge_read (struct cobsort *hp, struct cob_sort_reader *r)
+{
+	cob_file	*sort_file = hp->pointer;
+	cob_file	*data_file = hp->merge_file[r->fd];
+	unsigned char	*rec;
+	unsigned char	*prev;
+	cob_u64_t	u;
+	size_t		j;
+	int		cmp;
+
+	cob_read_next (data_file, NULL, COB_READ_NEXT);
+	if (data_file->file_status[0] != '0') {
+		cob_close (data_file, NULL, COB_CLOSE_NORMAL, 0);
+		hp->merge_file[r->fd] = NULL;
+		return 0;
+	}
+	cob_copy_check (sort_file, data_file);
+	hp->stats.records_in++;
+	prev = r->buf + r->pos;
+	r->pos = hp->r_size - r->pos;
+	rec = r->buf + r->pos;
+	cob_sort_fill (hp, rec, sort_file->record->data);
+	/* Equal keys are returned in the order of the USING files */
+	u = (cob_u64_t)r->fd;
+	for (j = COB_SORT_UNIQUE; j-- > 0;) {
+		rec[hp->key_size + j] = (unsigned char)u;
+		u >>= 8;
+	}
+	r->cur.rec = rec;
+	r->cur.prefix = cob_sort_prefix (hp, rec);
+	if (file_setptr->cob_merge_check && r->len) {
+		cmp = memcmp (prev, rec, hp->cmp_size);
+		if (cmp == 0 && !hp->all_norm) {
+			cmp = cob_sort_cmp_keys (hp, prev, rec);
+		}
+		if (cmp > 0) {
+			return -1;
+		}
+	}
+	r->len = 1;
+	return 1;
+}
+
+/* Read the first record of each file of the MERGE */
+static void
+cob_sort_merge_start (struct cobsort *hp)
+{
+	struct cob_sort_reader	*r;
+	const size_t		n = hp->merge_count;
+	size_t			i;
+
+	if (hp->nkey == NULL) {
+		cob_sort_keys_setup (hp);
+	}
+	hp->retrieving = 1;
+	hp->reader = cob_malloc (n * sizeof (struct cob_sort_reader));
+	hp->heap = cob_malloc (n * sizeof (struct cob_sort_reader *));
+	hp->rbuf_mem = cob_malloc (n * 2 * hp->r_size);
+	hp->rbuf = hp->rbuf_mem;
+	hp->stats.memory = (cob_s64_t)(n * 2 * hp->r_size);
+	hp->nreaders = 0;
+	for (i = 0; i < n; i++) {
+		if (hp->merge_file[i] == NULL) {
+			continue;
+		}
+		r = &hp->reader[i];
+		r->buf = hp->rbuf + i * 2 * hp->r_size;
+		r->fd = (int)i;
+		if (cob_sort_merge_read (hp, r) > 0) {
+			hp->heap[hp->nreaders++] = r;
+		}
+	}
+	for (i = hp->nreaders / 2; i-- > 0;) {
+		cob_sort_reader_down (hp, i);
+	}
+}
+
+/* Return the next record of the MERGE */
+static int
+cob_sort_merge_get (struct cobsort *hp, unsigned char *p)
+{
+	int	res;
+
+	if (hp->merge_err) {
+		return hp->merge_err;
+	}
+	/* The file of the record returned last is read on only now,
+	   as the record was returned into the record area of the MERGE */
+	if (hp->merge_step) {
+		hp->merge_step = 0;
+		res = cob_sort_merge_read (hp, hp->heap[0]);
+		if (res < 0) {
+			hp->merge_err = COBSORTSEQERR;
+			return hp->merge_err;
+		}
+		if (res == 0) {
+			hp->heap[0] = hp->heap[--hp->nreaders];
+		}
+		if (hp->nreaders > 1) {
+			cob_sort_reader_down (hp, 0);
+		}
+	}
+	if (hp->nreaders == 0) {
+		return COBSORTEND;
 	}
-	q->next = z->first;
-	z->first = q;
-	z->count++;
+	memcpy (p, hp->heap[0]->cur.rec + hp->data_off, hp->size);
+	hp->merge_step = 1;
 	return 0;
 }
 
@@ -8550,53 +12335,167 @@ static int
 cob_file_sort_retrieve (cob_file *f, unsigned char *p)
 {
 	struct cobsort		*hp;
-	struct cobitem		*next;
-	struct queue_struct	*z;
-	int			move;
-	int			source;
 	int			res;
 
 	hp = f->file;
 	if (!hp) {
 		return COBSORTNOTOPEN;
 	}
+	if (hp->merge_file) {
+		if (!hp->retrieving) {
+			cob_sort_phase (hp, 1);
+			cob_sort_merge_start (hp);
+			cob_sort_phase (hp, 2);
+		}
+		res = cob_sort_merge_get (hp, p);
+		if (res == 0) {
+			hp->stats.records_out++;
+		}
+		return res;
+	}
 	if (!hp->retrieving) {
+		cob_sort_phase (hp, 1);
 		res = cob_file_sort_process (hp);
+		cob_sort_phase (hp, 2);
 		if (res) {
 			return res;
 		}
 	}
 	if (hp->files_used) {
-		source = hp->retrieval_queue;
-		if (hp->queue[source].first->end_of_block) {
-			if (hp->queue[source + 1].first->end_of_block) {
-				return COBSORTEND;
-			}
-			move = 1;
-		} else if (hp->queue[source + 1].first->end_of_block) {
-			move = 0;
-		} else {
-			res = cob_file_sort_compare (hp->queue[source].first,
-						hp->queue[source + 1].first,
-						hp->pointer);
-			move = res < 0 ? 0 : 1;
+		if (hp->nreaders == 0) {
+			return COBSORTEND;
 		}
-		memcpy (p, hp->queue[source + move].first->item, hp->size);
+		memcpy (p, hp->heap[0]->cur.rec + hp->data_off, hp->size);
 		/* LCOV_EXCL_START */
-		if (cob_read_item (hp, source + move)) {
+		if (cob_sort_merge_next (hp)) {
 			return COBSORTFILEERR;
 		}
 		/* LCOV_EXCL_STOP */
 	} else {
-		z = &hp->queue[hp->retrieval_queue];
-		if (z->first == NULL) {
+		if (hp->entry_next >= hp->entry_count) {
 			return COBSORTEND;
 		}
-		memcpy (p, z->first->item, hp->size);
-		next = z->first->next;
-		z->first->next = hp->empty;
-		hp->empty = z->first;
-		z->first = next;
+		memcpy (p, hp->entry[hp->entry_next++].rec + hp->data_off,
+			hp->size);
+	}
+	hp->stats.records_out++;
+	return 0;
+}
+
+/*
+ * USING and GIVING pass the records of fixed-length SEQUENTIAL files
+ * in batches of COB_SORT_BATCH bytes: the records are read in blocks
+ * and RELEASEd from there, and written with cob_write_multi
+ */
+
+#define COB_SORT_BATCH		(256 * 1024)
+
+static int
+cob_sort_batch_ok (cob_file *f)
+{
+	return f->organization == COB_ORG_SEQUENTIAL
+	    && f->io_routine == COB_IO_SEQUENTIAL
+	    && f->record_min == f->record_max
+	    && f->record_max > 0
+	    && f->variable_record == NULL
+	    && !COB_FILE_SPECIAL (f)
+	    && !(file_setptr->cob_line_trace && f->trace_io);
+}
+
+/*
+ * Add the most records the USING file can have to the hint for the
+ * memory of the SORT: for fixed-length records the exact count,
+ * otherwise a record for each byte
+ */
+static void
+cob_sort_using_hint (struct cobsort *hp, cob_file *data_file)
+{
+	cob_s64_t	size;
+
+	size = cob_file_input_size (data_file, NULL);
+	if (size < 0) {
+		hp->mem_hint = -1;
+	} else {
+		if (data_file->organization == COB_ORG_SEQUENTIAL
+		 && data_file->record_min == data_file->record_max
+		 && data_file->record_max > 0) {
+			size /= data_file->record_max;
+		}
+		hp->mem_hint += size;
+	}
+	if (hp->nkey != NULL) {
+		cob_sort_mem_setup (hp);
+	}
+}
+
+/* RELEASE a record read by USING */
+static int
+cob_sort_using_put (cob_file *sort_file, cob_file *data_file,
+		    const unsigned char *rec)
+{
+	if (data_file->record_max == sort_file->record_max) {
+		return cob_file_sort_submit (sort_file, rec);
+	}
+	memcpy (data_file->record->data, rec, data_file->record_max);
+	cob_copy_check (sort_file, data_file);
+	return cob_file_sort_submit (sort_file, sort_file->record->data);
+}
+
+/*
+ * Read the rest of the USING file (or of its current member) in blocks;
+ * a short record at the end is RELEASEd as READ gives it, with status 04
+ */
+static int
+cob_sort_using_batch (cob_file *sort_file, cob_file *data_file,
+		      unsigned char *buf, const size_t size)
+{
+	const size_t	rsize = data_file->record_max;
+	size_t		len = 0;
+	size_t		n;
+	size_t		i;
+	int		rd;
+	int		ret;
+
+	for (;;) {
+		rd = cob_iobuf_read (data_file, buf + len, size - len);
+		if (rd <= 0) {
+			break;
+		}
+		len += (size_t)rd;
+		n = len / rsize;
+		for (i = 0; i < n; ++i) {
+			ret = cob_sort_using_put (sort_file, data_file,
+						  buf + i * rsize);
+			if (ret) {
+				return ret;
+			}
+		}
+		if (n > 0) {
+			/* The record area holds the last record, as after READ */
+			memcpy (data_file->record->data, buf + (n - 1) * rsize, rsize);
+		}
+		if (data_file->io_stats) {
+			data_file->stats[COB_LAST_READ_SEQ - 1].rqst_io += (int)n;
+		}
+		len -= n * rsize;
+		memmove (buf, buf + n * rsize, len);
+		if (data_file->iobuf) {
+			cob_prefetch_note (data_file, cob_iobuf_tell (data_file));
+		}
+	}
+	/* LCOV_EXCL_START */
+	if (rd < 0) {
+		data_file->last_operation = COB_LAST_READ_SEQ;
+		cob_file_save_status (data_file, NULL, COB_STATUS_30_PERMANENT_ERROR);
+		return 0;
+	}
+	/* LCOV_EXCL_STOP */
+	if (len > 0) {
+		data_file->last_operation = COB_LAST_READ_SEQ;
+		cob_file_save_status (data_file, NULL, COB_STATUS_04_SUCCESS_INCOMPLETE);
+		memcpy (data_file->record->data, buf, len);
+		cob_copy_check (sort_file, data_file);
+		return cob_file_sort_submit (sort_file, sort_file->record->data);
 	}
 	return 0;
 }
@@ -8604,29 +12503,95 @@ cob_file_sort_retrieve (cob_file *f, unsigned char *p)
 void
 cob_file_sort_using (cob_file *sort_file, cob_file *data_file)
 {
+	struct cobsort	*hp = sort_file->file;
+	unsigned char	*buf = NULL;
+	size_t		size = 0;
 	int		ret;
 
 	cob_open (data_file, COB_OPEN_INPUT, 0, NULL);
+	if (hp != NULL && hp->mem_hint >= 0) {
+		cob_sort_using_hint (hp, data_file);
+	}
+	if (cob_sort_batch_ok (data_file)) {
+		size = COB_SORT_BATCH - COB_SORT_BATCH % data_file->record_max;
+		if (size == 0) {
+			size = data_file->record_max;
+		}
+		buf = cob_fast_malloc (size);
+	}
 	for (;;) {
+		/* The first record of each file is read as usual */
 		cob_read_next (data_file, NULL, COB_READ_NEXT);
 		if (data_file->file_status[0] != '0') {
 			break;
 		}
 		cob_copy_check (sort_file, data_file);
 		ret = cob_file_sort_submit (sort_file, sort_file->record->data);
+		if (!ret && buf) {
+			ret = cob_sort_using_batch (sort_file, data_file, buf, size);
+			if (data_file->file_status[0] != '0') {
+				break;
+			}
+		}
 		if (ret) {
 			break;
 		}
 	}
+	if (buf) {
+		cob_free (buf);
+	}
 	cob_close (data_file, NULL, COB_CLOSE_NORMAL, 0);
 }
 
+/* USING file of a MERGE, opened here and read while merging */
+void
+cob_file_merge_using (cob_file *sort_file, cob_file *data_file)
+{
+	struct cobsort	*hp = sort_file->file;
+
+	if (hp == NULL) {
+		return;
+	}
+	cob_open (data_file, COB_OPEN_INPUT, 0, NULL);
+	if (data_file->file_status[0] != '0') {
+		cob_close (data_file, NULL, COB_CLOSE_NORMAL, 0);
+		return;
+	}
+	if (hp->merge_file == NULL) {
+		hp->merge_file = cob_malloc (sizeof (cob_file *));
+	} else {
+		hp->merge_file = cob_realloc (hp->merge_file,
+				hp->merge_count * sizeof (cob_file *),
+				(hp->merge_count + 1) * sizeof (cob_file *));
+	}
+	hp->merge_file[hp->merge_count++] = data_file;
+}
+
+/* Write 'n' records of a GIVING batch, going on after a failing one */
+static void
+cob_sort_giving_batch (cob_file *f, const unsigned char *buf,
+		       const size_t n, const size_t stride)
+{
+	size_t	done = 0;
+
+	while (done < n) {
+		done += cob_write_multi (f, buf + done * stride, n - done, stride);
+		if (done < n) {
+			done++;
+		}
+	}
+}
+
 void
 cob_file_sort_giving (cob_file *sort_file, const size_t varcnt, ...)
 {
 	cob_file	**fbase;
 	struct cobsort	*hp;
+	unsigned char	*buf = NULL;
 	size_t		i;
+	size_t		n;
+	size_t		max = 0;
+	const size_t	stride = sort_file->record_max;
 	int		ret;
 	int		opt;
 	va_list		args;
@@ -8640,12 +12605,45 @@ cob_file_sort_giving (cob_file *sort_file, const size_t varcnt, ...)
 	for (i = 0; i < varcnt; ++i) {
 		cob_open (fbase[i], COB_OPEN_OUTPUT, 0, NULL);
 	}
+	/* Batches if all files take the records as they are */
+	for (i = 0; i < varcnt; ++i) {
+		if (!cob_sort_batch_ok (fbase[i])
+		 || fbase[i]->record_max != stride) {
+			break;
+		}
+	}
+	if (i == varcnt && stride > 0) {
+		max = COB_SORT_BATCH / stride;
+		if (max == 0) {
+			max = 1;
+		}
+		buf = cob_fast_malloc (max * stride);
+	}
 	for (;;) {
-		ret = cob_file_sort_retrieve (sort_file, sort_file->record->data);
+		if (buf) {
+			for (n = 0; n < max; ++n) {
+				ret = cob_file_sort_retrieve (sort_file, buf + n * stride);
+				if (ret) {
+					break;
+				}
+			}
+			for (i = 0; i < varcnt; ++i) {
+				cob_sort_giving_batch (fbase[i], buf, n, stride);
+			}
+		} else {
+			ret = cob_file_sort_retrieve (sort_file, sort_file->record->data);
+		}
 		if (ret) {
 			if (ret == COBSORTEND) {
 				sort_file->file_status[0] = '1';
 				sort_file->file_status[1] = '0';
+			} else if (ret == COBSORTSEQERR) {
+				hp = sort_file->file;
+				if (hp->sort_return) {
+					*(int *)(hp->sort_return) = 16;
+				}
+				sort_file->file_status[0] = '2';
+				sort_file->file_status[1] = '1';
 			} else {
 				hp = sort_file->file;
 				if (hp->sort_return) {
@@ -8656,6 +12654,9 @@ cob_file_sort_giving (cob_file *sort_file, const size_t varcnt, ...)
 			}
 			break;
 		}
+		if (buf) {
+			continue;
+		}
 		for (i = 0; i < varcnt; ++i) {
 			if (COB_FILE_SPECIAL (fbase[i]) 
 			 || fbase[i]->organization == COB_ORG_LINE_SEQUENTIAL) {
@@ -8671,45 +12672,105 @@ cob_file_sort_giving (cob_file *sort_file, const size_t varcnt, ...)
 	for (i = 0; i < varcnt; ++i) {
 		cob_close (fbase[i], NULL, COB_CLOSE_NORMAL, 0);
 	}
+	if (buf) {
+		cob_free (buf);
+	}
 	cob_free (fbase);
 }
 
+/*
+ * SORT of a table: the elements get their keys normalized like the
+ * records of a SORT file, are sorted in memory as entries, by multiple
+ * threads for large tables with COB_SORT_THREADS, and are then copied
+ * back in order; the sequence in the normalized keys keeps it stable;
+ * all state is local, so nested table SORTs do not interfere
+ */
+void
+cob_sort_table (cob_field *f, const size_t n, cob_file_key *keys,
+		const int nkeys, const unsigned char *collating_sequence)
+{
+	cob_file	*tf;
+	struct cobsort	*hp;
+	unsigned char	*data;
+	unsigned char	*rec;
+	size_t		i;
+
+	if (n < 2) {
+		return;
+	}
+	tf = cob_malloc (sizeof (cob_file));
+	tf->keys = keys;
+	tf->nkeys = nkeys;
+	tf->sort_collating = collating_sequence;
+	tf->record_max = f->size;
+	hp = cob_malloc (sizeof (struct cobsort));
+	hp->pointer = tf;
+	hp->size = f->size;
+	hp->threads = file_setptr->cob_sort_threads;
+#ifdef COB_USE_SORT_THREADS
+	if (hp->threads > COB_SORT_THREADS_MAX) {
+		hp->threads = COB_SORT_THREADS_MAX;
+	}
+#else
+	hp->threads = 1;
+#endif
+	cob_sort_keys_init (hp);
+	data = cob_fast_malloc (n * hp->r_size);
+	hp->entry = cob_fast_malloc (n * sizeof (struct cob_sort_entry));
+	hp->entry_max = n;
+	for (i = 0; i < n; ++i) {
+		rec = data + i * hp->r_size;
+		cob_sort_fill (hp, rec, f->data + i * f->size);
+		hp->entry[i].prefix = cob_sort_prefix (hp, rec);
+		hp->entry[i].rec = rec;
+	}
+	hp->entry_count = n;
+	cob_sort_memory (hp);
+	for (i = 0; i < n; ++i) {
+		memcpy (f->data + i * f->size, hp->entry[i].rec + hp->data_off,
+			f->size);
+	}
+	cob_free (data);
+	cob_free (hp->entry);
+	if (hp->entry_tmp) {
+		cob_free (hp->entry_tmp);
+	}
+	cob_free (hp->nkey);
+	if (hp->use_dec) {
+		cob_decimal_clear (&hp->dec);
+	}
+	cob_free (hp);
+	cob_free (tf);
+}
+
 void
 cob_file_sort_init (cob_file *f, const unsigned int nkeys,
 		    const unsigned char *collating_sequence,
 		    void *sort_return, cob_field *fnstatus)
 {
 	struct cobsort	*p;
-	size_t		n;
 
 	p = cob_malloc (sizeof (struct cobsort));
 	p->fnstatus = fnstatus;
 	p->size = f->record_max;
-	p->r_size = f->record_max + sizeof (size_t);
-	p->w_size = f->record_max + sizeof (size_t) + 1;
-	n = sizeof (struct cobitem) - offsetof (struct cobitem, item);
-	if (f->record_max <= n) {
-		p->alloc_size = sizeof (struct cobitem);
-	} else {
-		p->alloc_size = offsetof (struct cobitem, item) + f->record_max;
-	}
-	if (p->alloc_size % sizeof (void *)) {
-		p->alloc_size += sizeof (void *) - (p->alloc_size % sizeof (void *));
-	}
-	p->chunk_size = file_setptr->cob_sort_chunk;
-	if (p->chunk_size % p->alloc_size) {
-		p->chunk_size += p->alloc_size - (p->chunk_size % p->alloc_size);
-	}
+	/* Item sizes and memory chunks are set up with the keys */
 	p->pointer = f;
 	if (sort_return) {
 		p->sort_return = sort_return;
 		*(int *)sort_return = 0;
 	}
-	p->mem_base = cob_fast_malloc (sizeof (struct sort_mem_struct));
-	p->mem_base->mem_ptr = cob_fast_malloc (p->chunk_size);
-	p->mem_base->next = NULL;
-	p->mem_size = p->chunk_size;
-	p->mem_total = p->chunk_size;
+	p->entry_max = 1024;
+	p->entry = cob_malloc (p->entry_max * sizeof (struct cob_sort_entry));
+	p->threads = file_setptr->cob_sort_threads;
+#ifdef COB_USE_SORT_THREADS
+	if (p->threads > COB_SORT_THREADS_MAX) {
+		p->threads = COB_SORT_THREADS_MAX;
+	}
+#else
+	p->threads = 1;
+#endif
+	p->phase = 3;
+	cob_sort_phase (p, 0);
 	f->file = p;
 	f->keys = cob_malloc (sizeof (cob_file_key) * nkeys);
 	f->nkeys = 0;
@@ -8742,11 +12803,57 @@ cob_file_sort_close (cob_file *f)
 	hp = f->file;
 	if (hp) {
 		fnstatus = hp->fnstatus;
+		cob_sort_phase (hp, 3);
+		hp->stats.bytes = hp->stats.records_in * (cob_s64_t)hp->size;
+		last_sort_stats = hp->stats;
+		last_sort_done = 1;
+		if (file_setptr->cob_sort_stats) {
+			cob_sort_stats_write (f, &hp->stats);
+		}
 		cob_free_list (hp);
-		for (i = 0; i < 4; ++i) {
-			if (hp->file[i].fp != NULL) {
-				fclose (hp->file[i].fp);
+		if (hp->entry) {
+			cob_free (hp->entry);
+		}
+		if (hp->entry_tmp) {
+			cob_free (hp->entry_tmp);
+		}
+		if (hp->run) {
+			cob_free (hp->run);
+		}
+		if (hp->reader) {
+			cob_free (hp->reader);
+			cob_free (hp->heap);
+			cob_free (hp->rbuf_mem);
+		}
+		if (hp->wbuf) {
+			cob_free (hp->wbuf_mem);
+		}
+		if (hp->zraw) {
+			cob_free (hp->zraw);
+		}
+		if (hp->nkey) {
+			cob_free (hp->nkey);
+		}
+		if (hp->merge_file) {
+			for (i = 0; i < hp->merge_count; ++i) {
+				if (hp->merge_file[i] != NULL) {
+					cob_close (hp->merge_file[i], NULL,
+						   COB_CLOSE_NORMAL, 0);
+				}
+			}
+			cob_free (hp->merge_file);
+		}
+		if (hp->use_dec) {
+			cob_decimal_clear (&hp->dec);
+		}
+		if (hp->tmp_fd) {
+			for (i = 0; i < 2 * hp->ndirs; ++i) {
+				if (hp->tmp_fd[i] >= 0) {
+					close (hp->tmp_fd[i]);
+				}
 			}
+			cob_free (hp->tmp_fd);
+			cob_free (hp->tmp_end);
 		}
 		cob_free (hp);
 	}
@@ -8805,9 +12912,86 @@ cob_file_return (cob_file *f)
 	if (hp && hp->sort_return) {
 		*(int *)(hp->sort_return) = 16;
 	}
+	if (ret == COBSORTSEQERR) {
+		cob_file_save_status (f, fnstatus, COB_STATUS_21_KEY_INVALID);
+		return;
+	}
 	cob_file_save_status (f, fnstatus, COB_STATUS_30_PERMANENT_ERROR);
 }
 
+/*
+ * Statistics of the SORT of 'f' while it is active, otherwise (or with
+ * 'f' NULL) of the SORT closed last; returns 1 if there is none
+ */
+int
+cob_sort_get_stats (cob_file *f, cob_sort_stats *st)
+{
+	struct cobsort	*hp;
+	cob_s64_t	wall;
+	cob_s64_t	cpu;
+
+	hp = f != NULL && f->organization == COB_ORG_SORT ? f->file : NULL;
+	if (hp != NULL) {
+		*st = hp->stats;
+		st->bytes = st->records_in * (cob_s64_t)hp->size;
+		if (hp->phase < 3) {
+			cob_sort_clock (&wall, &cpu);
+			st->wall[hp->phase] += wall - hp->phase_wall;
+			st->cpu[hp->phase] += cpu - hp->phase_cpu;
+		}
+		return 0;
+	}
+	if (!last_sort_done) {
+		memset (st, 0, sizeof (cob_sort_stats));
+		return 1;
+	}
+	*st = last_sort_stats;
+	return 0;
+}
+
+/*
+ * CBL_GC_SORT_STATS: statistics of the SORT closed last as up to 13
+ * unsigned 8-byte big-endian numbers, in the order of cob_sort_stats
+ */
+int
+cob_sys_sort_stats (unsigned char *data)
+{
+	cob_sort_stats	st;
+	cob_u64_t	v[13];
+	size_t		size;
+	int		i;
+	int		ret;
+
+	COB_CHK_PARMS (CBL_GC_SORT_STATS, 1);
+
+	if (COB_MODULE_PTR->cob_procedure_params[0] == NULL) {
+		return -1;
+	}
+	ret = cob_sort_get_stats (NULL, &st);
+	v[0] = (cob_u64_t)st.records_in;
+	v[1] = (cob_u64_t)st.records_out;
+	v[2] = (cob_u64_t)st.bytes;
+	v[3] = (cob_u64_t)st.memory;
+	v[4] = (cob_u64_t)st.runs;
+	v[5] = (cob_u64_t)st.passes;
+	v[6] = (cob_u64_t)st.temp_bytes;
+	for (i = 0; i < 3; i++) {
+		v[7 + 2 * i] = (cob_u64_t)st.wall[i];
+		v[8 + 2 * i] = (cob_u64_t)st.cpu[i];
+	}
+	size = COB_MODULE_PTR->cob_procedure_params[0]->size / 8;
+	if (size > 13) {
+		size = 13;
+	}
+	for (i = 0; i < (int)size; i++) {
+#ifndef	WORDS_BIGENDIAN
+		v[i] = COB_BSWAP_64 (v[i]);
+#endif
+		memcpy (data + i * 8, &v[i], (size_t)8);
+	}
+	return ret;
+}
+
 char *
 cob_get_filename_print (cob_file* file, const int show_resolved_name)
 {
@@ -8945,7 +13129,8 @@ cob_init_fileio (cob_global *lptr, cob_settings *sptr)
 	file_cache = NULL;
 	eop_status = 0;
 	check_eop_status = 0;
-	if (file_setptr->cob_sort_chunk > (file_setptr->cob_sort_memory / 2)) {
+	if (file_setptr->cob_sort_memory != 0
+	 && file_setptr->cob_sort_chunk > (file_setptr->cob_sort_memory / 2)) {
 		file_setptr->cob_sort_chunk = file_setptr->cob_sort_memory / 2;
 	}
 
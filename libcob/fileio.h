@@ -68,6 +68,32 @@
 #include <fcntl.h>
 #endif
 
+#if defined (HAVE_SYS_MMAN_H) && defined (HAVE_MMAP)
+#include <sys/mman.h>
+#define COB_USE_MMAP	1
+#endif
+
+#if defined (HAVE_PTHREAD) && !defined (_WIN32)
+#include <pthread.h>
+#define COB_USE_PREFETCH	1
+#define COB_USE_SORT_THREADS	1
+#endif
+
+#if defined (HAVE_SYS_UIO_H) && defined (HAVE_WRITEV)
+#include <sys/uio.h>
+#define COB_USE_WRITEV	1
+#endif
+
+#if defined (HAVE_ZLIB)
+#include <zlib.h>
+#endif
+#if defined (HAVE_ZSTD)
+#include <zstd.h>
+#endif
+#if (defined (HAVE_ZLIB) || defined (HAVE_ZSTD)) && defined (HAVE_FOPENCOOKIE)
+#define COB_USE_COMPRESS	1
+#endif
+
 #ifdef	_WIN32
 
 #define WIN32_LEAN_AND_MEAN
@@ -169,6 +195,7 @@ struct cob_fileio_funcs {
 	int	(*rollback)		(cob_file_api *, cob_file *);
 	int	(*iounlock)		(cob_file_api *, cob_file *);
 	char * (*ioversion)	(void);
+	int	(*iomapinfo)	(cob_file_api *, cob_file *, cob_u64_t *, cob_u64_t *, cob_u64_t *);
 };
 
 COB_EXPIMP	cob_global		*file_globptr;
@@ -40,11 +40,13 @@ static int lmdb_file_delete  (cob_file_api *, cob_file *, char *filename);
 static void cob_lmdb_exit_fileio (cob_file_api *a);
 static int cob_lmdb_fork (cob_file_api *a);
 static int ix_lmdb_file_unlock(cob_file_api *, cob_file *);
+static int lmdb_sync	(cob_file_api *, cob_file *);
+static int lmdb_commit	(cob_file_api *, cob_file *);
+static int lmdb_rollback (cob_file_api *, cob_file *);
 static char * lmdb_version (void);
+static int lmdb_map_stats (cob_file_api *, cob_file *, cob_u64_t *, cob_u64_t *, cob_u64_t *);
 void cob_lmdb_init_fileio (cob_file_api *a);
 
-static int ix_lmdb_dummy () { return 0; }
-
 static const struct cob_fileio_funcs lmdb_funcs = {
 	lmdb_open,
 	lmdb_close,
@@ -58,15 +60,17 @@ static const struct cob_fileio_funcs lmdb_funcs = {
 	cob_lmdb_init_fileio,
 	cob_lmdb_exit_fileio,
 	cob_lmdb_fork,
-	ix_lmdb_dummy,
-	ix_lmdb_dummy,
-	ix_lmdb_dummy,
+	lmdb_sync,
+	lmdb_commit,
+	lmdb_rollback,
 	ix_lmdb_file_unlock,
-	lmdb_version
+	lmdb_version,
+	lmdb_map_stats
 };
 
 static char		*db_buff = NULL;
 static const char	**db_data_dir = NULL;
+static struct indexed_file	*lmdb_files = NULL;	/* Open files */
 
 #define INTTYPES_H_MISSING
 #include <lmdb.h>
@@ -76,7 +80,8 @@ static const char	**db_data_dir = NULL;
 #endif
 
 #include <sys/stat.h>
-#define MDB_MAX_MAP_INC 1073741824
+#define LMDB_MAP_ROUND	(1024 * 1024)	/* Map sizes are rounded to 1M */
+#define LMDB_NODE_SIZE	16		/* Overhead of an entry in a page */
 
 #define WARN(format, ...)  {						\
    cob_runtime_warning("%s:%d: " format "\n",				\
@@ -205,6 +210,13 @@ lmdb_txn_begin (int line, MDB_env *env, MDB_txn *parent, unsigned int flags, MDB
 	int	sts;
 	sts = mdb_txn_begin( env, parent, flags, txn);
 	DEBUG_LOG("flmdb",("%d: mdb_txn_begin(%p, %p, %u, %p) -> %d\n", line, env, parent, flags, txn, sts));
+	if (sts == MDB_MAP_RESIZED	/* Grown by another process: take its size, */
+	 && parent == NULL) {		/* never while a batch is open */
+		if ((sts = mdb_env_set_mapsize (env, 0)) == MDB_SUCCESS) {
+			sts = mdb_txn_begin (env, parent, flags, txn);
+		}
+		DEBUG_LOG("flmdb",("%d: map resized, mdb_txn_begin -> %d\n", line, sts));
+	}
 	return sts;
 }
 #define mdb_txn_begin(env, parent, flags, txn)		\
@@ -222,32 +234,25 @@ lmdb_txn_commit (int line, MDB_txn *txn)
 #define mdb_txn_commit(txn)			\
   lmdb_txn_commit(__LINE__, (txn))
 
-#if 0 /* Currently unused */
 /* Renew a cursor handle. */
 static int
 lmdb_cursor_renew (int line, MDB_txn *txn, MDB_cursor *cursor) 
 {
-	DEBUG_LOG("flmdb",( "%d: mdb_cursor_renew(%p, %p)\n", line, txn, cursor) ;
-	return mdb_cursor_renew (txn, cursor);
+	int sts;
+	sts = mdb_cursor_renew (txn, cursor);
+	DEBUG_LOG("flmdb",("%d: mdb_cursor_renew(%p, %p) -> %d\n", line, txn, cursor, sts));
+	return sts;
 }
 #define mdb_cursor_renew(txn, cursor)		\
-  lmdb_cursor_renew (__LINE__, (txn) , (cursor) );
-
-/* Store items into a database. */
-static int
-lmdb_put (int line, MDB_txn *txn, MDB_dbi dbi, MDB_val *key, MDB_val *data, unsigned int flags) 
-{
-    DEBUG_LOG("flmdb",("%d: mdb_put(%p, %d, %p, %p, %u)\n", line, txn, dbi, key, data, flags));
-    return mdb_put(txn, dbi, key, data, flags);
-}
-#define mdb_put(txn, dbi, key, data, flags)		\
-  lmdb_put(__LINE__, (txn), (dbi), (key), (data), (flags) )
+  lmdb_cursor_renew (__LINE__, (txn) , (cursor) )
 
 /* Renew a read-only transaction. */
 static int
 lmdb_txn_renew (int line, MDB_txn *txn) {
-	DEBUG_LOG("flmdb",("%d: mdb_txn_renew(%p)\n", line, txn));
-	return mdb_txn_renew(txn);			
+	int sts;
+	sts = mdb_txn_renew(txn);
+	DEBUG_LOG("flmdb",("%d: mdb_txn_renew(%p) -> %d\n", line, txn, sts));
+	return sts;
 }
 #define mdb_txn_renew(txn)			\
   lmdb_txn_renew(__LINE__, (txn))
@@ -255,20 +260,45 @@ lmdb_txn_renew (int line, MDB_txn *txn) {
 /* Reset a read-only transaction. */
 static void
 lmdb_txn_reset (int line, MDB_txn *txn) {
-	DEBUG_LOG("flmdb",("%d: mdb_txn_reset(%p)\n", line, txn);
+	DEBUG_LOG("flmdb",("%d: mdb_txn_reset(%p)\n", line, txn));
 	mdb_txn_reset(txn);			
 }
 #define mdb_txn_reset(txn)			\
   lmdb_txn_reset( __LINE__, (txn))
+
+#if 0 /* Currently unused */
+/* Store items into a database. */
+static int
+lmdb_put (int line, MDB_txn *txn, MDB_dbi dbi, MDB_val *key, MDB_val *data, unsigned int flags) 
+{
+    DEBUG_LOG("flmdb",("%d: mdb_put(%p, %d, %p, %p, %u)\n", line, txn, dbi, key, data, flags));
+    return mdb_put(txn, dbi, key, data, flags);
+}
+#define mdb_put(txn, dbi, key, data, flags)		\
+  lmdb_put(__LINE__, (txn), (dbi), (key), (data), (flags) )
 #endif
 /* end trace macros */
 
 #define	cob_dbtsize_t		size_t
 
 struct indexed_file {
+	struct indexed_file	*next;	/* List of open files */
 	MDB_env		*db_env;
 	MDB_dbi		**db;		/* Database handlers */
 	MDB_txn		*txn;
+	MDB_txn		*batch;		/* Updates not committed yet (group commit) */
+	cob_s64_t	batch_start;	/* Time the batch was begun, in ms */
+	cob_u32_t	batch_ops;	/* Number of updates in the batch */
+	cob_u32_t	group;		/* Updates are grouped in batches */
+	cob_u32_t	tran;		/* Batch is the COBOL transaction */
+	MDB_txn		*optxn;		/* REWRITE, parent of its delete and write */
+	MDB_txn		*rtxn;		/* Read-only transaction, kept between reads */
+	MDB_cursor	**rcursor;	/* Cursors of 'rtxn' per key */
+	cob_u32_t	rtxn_active;	/* 'rtxn' is not reset */
+	cob_u32_t	rtxn_reads;	/* Reads done with the snapshot of 'rtxn' */
+	cob_s64_t	rtxn_start;	/* Time the snapshot was taken, in ms */
+	int		rpos;		/* Key whose cursor in 'rtxn' is on the
+					   record read last, -1 = none */
 	MDB_cursor	**cursor;
 	MDB_val		key;
 	MDB_val		data;
@@ -291,6 +321,8 @@ struct indexed_file {
 	cob_u32_t	db_flags;
 	cob_u32_t	txn_flags;
 	cob_u32_t	env_flags;
+	cob_u32_t	psize;		/* Page size of the map */
+	size_t		map_max;	/* Maximum size of the map, 0 = no limit */
 	struct flock    lock;
 };
 
@@ -412,8 +444,6 @@ get_dupno (cob_file *f, const cob_u32_t i)
 	/* Using a nested transaction so we don't mess up the write transacion in lmdb_write */
 	MDB_txn    *txn;
 	MDB_cursor *cursor;
-	txn    = cob_malloc(sizeof(MDB_txn *));
-	cursor = cob_malloc(sizeof(MDB_cursor *));
 
 	db_setkey(f, i);
 	memcpy (p->temp_key, p->key.mv_data, (size_t)p->maxkeylen);
@@ -493,6 +523,420 @@ mdb_cob_status( int mdb_error )
 	return COB_STATUS_30_PERMANENT_ERROR;
 }
 
+/*
+ * Map size: OPEN sets the map to COB_LMDB_MAPSIZE (or map_size= of the
+ * file), or to what the expected number of records (records= of the file,
+ * kept in its dictionary) needs if that is more; between updates the map
+ * grows ahead once three quarters of it are used, and when an update
+ * finds it full, doubling each time up to COB_LMDB_MAXSIZE (map_max=)
+ */
+
+/* Size of the map and how much of it is used */
+static int
+lmdb_map_info (struct indexed_file *p, cob_u64_t *size, cob_u64_t *used)
+{
+	MDB_envinfo	ei;
+	int		ret;
+
+	if ((ret = mdb_env_info (p->db_env, &ei)) != MDB_SUCCESS) {
+		return ret;
+	}
+	*size = (cob_u64_t)ei.me_mapsize;
+	*used = ((cob_u64_t)ei.me_last_pgno + 1) * p->psize;
+	return MDB_SUCCESS;
+}
+
+/* Round a map size up to LMDB_MAP_ROUND, within the address space */
+static size_t
+lmdb_map_round (cob_u64_t size)
+{
+	size = (size + LMDB_MAP_ROUND - 1) / LMDB_MAP_ROUND * LMDB_MAP_ROUND;
+	if (size > (cob_u64_t)((size_t)-1 / 2)) {
+		size = (cob_u64_t)((size_t)-1 / 2) / LMDB_MAP_ROUND * LMDB_MAP_ROUND;
+	}
+	return (size_t)size;
+}
+
+/* Map size for the expected number of records: the record and each
+   alternate key are an entry of a B-tree with pages two thirds full */
+static cob_u64_t
+lmdb_map_estimate (cob_file *f, struct indexed_file *p)
+{
+	cob_u64_t		per;
+	int			i;
+
+	if (f->expect_recs == 0) {
+		return 0;
+	}
+	per = (cob_u64_t)f->record_max + p->primekeylen + LMDB_NODE_SIZE;
+	for (i = 1; i < f->nkeys; i++) {
+		per += (cob_u64_t)db_keylen (f, i) + p->primekeylen
+			+ sizeof (unsigned int) + LMDB_NODE_SIZE;
+	}
+	return (cob_u64_t)f->expect_recs * per / 2 * 3;
+}
+
+/* Trace the size and the headroom of the map with COB_TRACE_IO */
+static void
+lmdb_map_trace (cob_file *f, const char *what)
+{
+	struct indexed_file	*p = f->file;
+	cob_u64_t		size, used;
+
+	if (lmdb_map_info (p, &size, &used) != MDB_SUCCESS) {
+		return;
+	}
+	if (used > size) {
+		used = size;
+	}
+	DEBUG_LOG ("flmdb", ("%s map of %s: size " CB_FMT_LLU " used " CB_FMT_LLU "\n",
+			what, f->select_name, size, used));
+	if (!file_setptr->cob_line_trace
+	 || !f->trace_io
+	 || file_setptr->cob_trace_file == NULL) {
+		return;
+	}
+	fprintf (file_setptr->cob_trace_file,
+		"      LMDB map %s %s: size " CB_FMT_LLU "K used " CB_FMT_LLU "K headroom " CB_FMT_LLU "K (%d%%)\n",
+		what, f->select_name, size / 1024, used / 1024, (size - used) / 1024,
+		size > 0 ? (int)((size - used) * 100 / size) : 0);
+}
+
+/* Size, use and limit of the map for cob_file_get_map_stats */
+static int
+lmdb_map_stats (cob_file_api *a, cob_file *f,
+		cob_u64_t *size, cob_u64_t *used, cob_u64_t *max)
+{
+	struct indexed_file	*p = f->file;
+	int			ret;
+
+	COB_UNUSED (a);
+	if ((ret = lmdb_map_info (p, size, used)) != MDB_SUCCESS) {
+		return ret;
+	}
+	if (*used > *size) {
+		*used = *size;
+	}
+	*max = p->map_max;
+	return 0;
+}
+
+/* Size the map of the file before its environment is opened */
+static int
+lmdb_map_open (cob_file *f, struct indexed_file *p)
+{
+	cob_u64_t		size = f->map_size;
+	cob_u64_t		need = lmdb_map_estimate (f, p);
+
+	p->map_max = f->map_max;
+	if (need > size) {
+		size = need;
+	}
+	if (p->map_max > 0
+	 && size > p->map_max) {
+		size = p->map_max;
+	}
+	if (size == 0) {
+		return MDB_SUCCESS;	/* LMDB's default, or the size of the file */
+	}
+	return mdb_env_set_mapsize (p->db_env, lmdb_map_round (size));
+}
+
+/* Double the map, there must be no transaction on it:
+   no batch, no update and the read transaction reset */
+static int
+lmdb_map_resize (cob_file *f, cob_u64_t size)
+{
+	struct indexed_file	*p = f->file;
+	cob_u64_t		next = size * 2;
+	int			ret;
+
+	if (p->batch != NULL
+	 || p->optxn != NULL
+	 || p->rtxn_active) {
+		return MDB_BAD_TXN;
+	}
+	if (p->map_max > 0
+	 && next > p->map_max) {
+		if (size >= p->map_max) {
+			return MDB_MAP_FULL;
+		}
+		next = p->map_max;
+	}
+	if ((ret = mdb_env_set_mapsize (p->db_env, lmdb_map_round (next))) != MDB_SUCCESS) {
+		return ret;
+	}
+	lmdb_map_trace (f, "grown");
+	return MDB_SUCCESS;
+}
+
+/* Before an update outside of a batch: grow the map ahead of time
+   once three quarters of it are used */
+static int
+lmdb_map_check (cob_file *f)
+{
+	struct indexed_file	*p = f->file;
+	cob_u64_t		size, used;
+	int			ret;
+
+	if (p->batch != NULL
+	 || lmdb_map_info (p, &size, &used) != MDB_SUCCESS
+	 || used < size / 4 * 3) {
+		return MDB_SUCCESS;
+	}
+	ret = lmdb_map_resize (f, size);
+	if (ret == MDB_MAP_FULL) {	/* At the maximum: fails once really full */
+		return MDB_SUCCESS;
+	}
+	return ret;
+}
+
+/*
+ * Group commit: with COB_LMDB_COMMIT or COB_LMDB_COMMIT_TIME each update
+ * runs in a transaction nested in a batch, which is committed after that
+ * many updates or milliseconds and on CLOSE, COMMIT and STOP RUN; with
+ * COB_FILE_ROLLBACK or APPLY COMMIT the batch is the COBOL transaction,
+ * it is only committed by COMMIT (or CLOSE) and abandoned by ROLLBACK;
+ * the batch holds the writer lock of the environment and the limits are
+ * only checked on the next operation of the file, so the updates are
+ * only grouped if the file is opened exclusively, where no other process
+ * can wait for that lock
+ */
+
+/* Time in milliseconds */
+static cob_s64_t
+lmdb_msec (void)
+{
+#if defined (HAVE_CLOCK_GETTIME) && defined (CLOCK_MONOTONIC)
+	struct timespec	ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (cob_s64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#else
+	return (cob_s64_t)time (NULL) * 1000;
+#endif
+}
+
+/* Begin the batch for an update */
+static int
+lmdb_batch_begin (struct indexed_file *p)
+{
+	int	ret;
+
+	if (!p->group
+	 || p->batch != NULL) {
+		return MDB_SUCCESS;
+	}
+	if ((ret = mdb_txn_begin (p->db_env, NULL, 0, &p->batch)) != MDB_SUCCESS) {
+		p->batch = NULL;
+		return ret;
+	}
+	p->batch_ops = 0;
+	p->batch_start = lmdb_msec ();
+	return MDB_SUCCESS;
+}
+
+/* Commit the batch, with 'abort' abandon it */
+static int
+lmdb_batch_end (struct indexed_file *p, const int abort)
+{
+	int	ret = MDB_SUCCESS;
+
+	if (p->batch == NULL) {
+		return MDB_SUCCESS;
+	}
+	if (abort) {
+		mdb_txn_abort (p->batch);
+	} else {
+		ret = mdb_txn_commit (p->batch);
+	}
+	DEBUG_LOG ("flmdb", ("%s batch of %u updates -> %d\n",
+			abort ? "abort" : "commit", p->batch_ops, ret));
+	p->batch = NULL;
+	p->batch_ops = 0;
+	return ret;
+}
+
+/* Count an update, commit the batch if it is full or old enough */
+static int
+lmdb_batch_check (struct indexed_file *p, const int update)
+{
+	if (p->batch == NULL) {
+		return MDB_SUCCESS;
+	}
+	if (update) {
+		p->batch_ops++;
+	}
+	if (p->tran) {
+		return MDB_SUCCESS;
+	}
+	if ((file_setptr->cob_lmdb_commit > 0
+	  && p->batch_ops >= file_setptr->cob_lmdb_commit)
+	 || (file_setptr->cob_lmdb_commit_time > 0
+	  && lmdb_msec () - p->batch_start
+	     >= (cob_s64_t)file_setptr->cob_lmdb_commit_time)) {
+		return lmdb_batch_end (p, 0);
+	}
+	return MDB_SUCCESS;
+}
+
+/* Begin the transaction of an operation, nested in the REWRITE
+   or the batch if any */
+static int
+lmdb_op_begin (struct indexed_file *p, const unsigned int flags)
+{
+	if (p->optxn != NULL) {
+		return mdb_txn_begin (p->db_env, p->optxn, 0, &p->txn);
+	}
+	if (p->batch != NULL) {
+		return mdb_txn_begin (p->db_env, p->batch, 0, &p->txn);
+	}
+	return mdb_txn_begin (p->db_env, NULL, flags, &p->txn);
+}
+
+/* The map is full: commit the batch (unless it is a COBOL transaction),
+   as the map can only be resized without a transaction, and grow it */
+static int
+lmdb_map_grow (cob_file *f)
+{
+	struct indexed_file	*p = f->file;
+	cob_u64_t		size, used;
+	int			ret;
+
+	if (p->batch != NULL) {
+		if (p->tran) {
+			return MDB_MAP_FULL;
+		}
+		if ((ret = lmdb_batch_end (p, 0)) != MDB_SUCCESS) {
+			return ret;
+		}
+	}
+	if ((ret = lmdb_map_info (p, &size, &used)) != MDB_SUCCESS
+	 || (ret = lmdb_map_resize (f, size)) != MDB_SUCCESS) {
+		return ret;
+	}
+	return lmdb_batch_begin (p);
+}
+
+/*
+ * Reads use a read-only transaction of the file that is kept between
+ * them, with a cursor per key: a READ NEXT/PREVIOUS continues from the
+ * position of the cursor instead of looking up the key read last; the
+ * transaction is reset by updates and renewed (with a new snapshot of
+ * the file) by the next START or random READ, or the next read after
+ * an update; while updates are grouped the reads are nested in the batch
+ *
+ * A snapshot keeps the pages of its records from being reused, so the
+ * file grows while it is held; it is therefore also renewed after
+ * LMDB_SNAP_READS reads or LMDB_SNAP_MSEC milliseconds, the next READ
+ * NEXT/PREVIOUS then looks up the key read last in the new snapshot
+ */
+#define LMDB_SNAP_READS		10000
+#define LMDB_SNAP_MSEC		1000
+
+/* Begin a read of key 'p->key_index', 'fresh' for a new snapshot */
+static int
+lmdb_read_begin (cob_file *f, const int fresh)
+{
+	struct indexed_file	*p = f->file;
+	int			ret;
+	int			i;
+
+	if ((ret = lmdb_batch_check (p, 0)) != MDB_SUCCESS) {
+		return ret;
+	}
+	if (p->batch != NULL) {
+		p->rpos = -1;
+		if ((ret = mdb_txn_begin (p->db_env, p->batch, 0, &p->txn)) != MDB_SUCCESS) {
+			return ret;
+		}
+		if (p->key_index != 0
+		 && (ret = mdb_cursor_open (p->txn, *p->db[0], &p->cursor[0])) != MDB_SUCCESS) {
+			mdb_txn_abort (p->txn);
+			return ret;
+		}
+		if ((ret = mdb_cursor_open (p->txn, *p->db[p->key_index],
+					&p->cursor[p->key_index])) != MDB_SUCCESS) {
+			mdb_txn_abort (p->txn);
+			return ret;
+		}
+		return MDB_SUCCESS;
+	}
+
+	if (p->rtxn == NULL) {
+		if ((ret = mdb_txn_begin (p->db_env, NULL, MDB_RDONLY, &p->rtxn)) != MDB_SUCCESS) {
+			p->rtxn = NULL;
+			return ret;
+		}
+		p->rtxn_active = 1;
+		p->rtxn_reads = 0;
+		p->rtxn_start = lmdb_msec ();
+	} else if (p->rtxn_active
+		&& (fresh
+		 || ++p->rtxn_reads >= LMDB_SNAP_READS
+		 || lmdb_msec () - p->rtxn_start >= LMDB_SNAP_MSEC)) {
+		mdb_txn_reset (p->rtxn);
+		p->rtxn_active = 0;
+	}
+	if (!p->rtxn_active) {
+		p->rpos = -1;
+		ret = mdb_txn_renew (p->rtxn);
+		if (ret == MDB_MAP_RESIZED
+		 && (ret = mdb_env_set_mapsize (p->db_env, 0)) == MDB_SUCCESS) {
+			ret = mdb_txn_renew (p->rtxn);
+		}
+		if (ret != MDB_SUCCESS) {
+			return ret;
+		}
+		p->rtxn_active = 1;
+		p->rtxn_reads = 0;
+		p->rtxn_start = lmdb_msec ();
+		for (i = 0; i < f->nkeys; i++) {
+			if (p->rcursor[i] != NULL
+			 && (ret = mdb_cursor_renew (p->rtxn, p->rcursor[i])) != MDB_SUCCESS) {
+				return ret;
+			}
+		}
+	}
+	if (p->rcursor[p->key_index] == NULL) {
+		if ((ret = mdb_cursor_open (p->rtxn, *p->db[p->key_index],
+					&p->rcursor[p->key_index])) != MDB_SUCCESS) {
+			p->rcursor[p->key_index] = NULL;
+			return ret;
+		}
+	}
+	p->txn = p->rtxn;
+	p->cursor[p->key_index] = p->rcursor[p->key_index];
+	return MDB_SUCCESS;
+}
+
+/* End a read, 'found' if the cursor is on the record read */
+static void
+lmdb_read_end (struct indexed_file *p, const int found)
+{
+	if (p->txn == p->rtxn) {
+		p->rpos = found ? (int)p->key_index : -1;
+		return;
+	}
+	mdb_cursor_close (p->cursor[p->key_index]);
+	if (p->key_index != 0) {
+		mdb_cursor_close (p->cursor[0]);
+	}
+	mdb_txn_commit (p->txn);
+	p->rpos = -1;
+}
+
+/* Release the snapshot of the read transaction before an update */
+static void
+lmdb_read_reset (struct indexed_file *p)
+{
+	if (p->rtxn_active) {
+		mdb_txn_reset (p->rtxn);
+		p->rtxn_active = 0;
+	}
+	p->rpos = -1;
+}
+
 static int
 lmdb_write_internal (cob_file *f, const int rewrite, const int opt, unsigned int ds)
 {
@@ -504,7 +948,7 @@ lmdb_write_internal (cob_file *f, const int rewrite, const int opt, unsigned int
 
 	COB_UNUSED(opt);
 
-	if ((ret = mdb_txn_begin(p->db_env, NULL, p->txn_flags, &p->txn)) != MDB_SUCCESS) {
+	if ((ret = lmdb_op_begin (p, p->txn_flags)) != MDB_SUCCESS) {
 		return ret;
 	}
 
@@ -583,7 +1027,7 @@ lmdb_write_internal (cob_file *f, const int rewrite, const int opt, unsigned int
 		db_setkey (f, i);
 
 		if ((ret = mdb_cursor_put(p->cursor[i],&p->key,&p->data,flags)) != MDB_SUCCESS) {
-			mdb_txn_commit(p->txn);
+			mdb_txn_abort(p->txn);	/* Do not keep the record without this key */
 			return ret;
 		}
 	}
@@ -604,7 +1048,6 @@ lmdb_start_internal (cob_file *f, const int cond, cob_field *key,
 	struct indexed_file	*p = f->file;
 	int			len, fullkeylen, partlen;
 	int			ret = 0;
-	int     rc = 0;
 	cob_u32_t		dupno = 0;
 	int			key_index;
 
@@ -622,21 +1065,8 @@ lmdb_start_internal (cob_file *f, const int cond, cob_field *key,
 	db_setkey (f, p->key_index);
 	p->key.mv_size = partlen;
 
-	/* Start the transaction */
-	if ((ret = mdb_txn_begin(p->db_env, NULL, p->txn_flags, &p->txn)) != MDB_SUCCESS) {
-		return mdb_cob_status(ret);
-	}
-
-	/* Open a cursor for an alternate key */
-	if (p->key_index !=0) {
-		if ((ret = mdb_cursor_open(p->txn, *p->db[0], &p->cursor[0])) != MDB_SUCCESS) {
-			mdb_txn_abort(p->txn);
-			return mdb_cob_status(ret);
-		}
-	}
-
-	/* Create a cursor */
-	if ((ret = mdb_cursor_open(p->txn,*p->db[p->key_index], &p->cursor[p->key_index])) != MDB_SUCCESS) {
+	/* Start the transaction, with a new snapshot */
+	if ((ret = lmdb_read_begin (f, 1)) != MDB_SUCCESS) {
 		return mdb_cob_status(ret);
 	}
 
@@ -722,10 +1152,7 @@ lmdb_start_internal (cob_file *f, const int cond, cob_field *key,
 		}
 	}
 
-	mdb_cursor_close(p->cursor[p->key_index]);
-	if ((rc = mdb_txn_commit(p->txn)) != MDB_SUCCESS) {
-		return mdb_cob_status(rc);
-	}
+	lmdb_read_end (p, ret == MDB_SUCCESS);
 	return (ret == MDB_SUCCESS) ? COB_STATUS_00_SUCCESS : COB_STATUS_23_KEY_NOT_EXISTS;
 
 }
@@ -741,11 +1168,12 @@ lmdb_delete_internal (cob_file *f, const int rewrite)
 	COB_UNUSED(flags);
 
 	flags = 0;
-	if ((ret = mdb_txn_begin(p->db_env, NULL, p->txn_flags, &p->txn)) != MDB_SUCCESS) {
+	if ((ret = lmdb_op_begin (p, p->txn_flags)) != MDB_SUCCESS) {
 		return mdb_cob_status(ret);
 	}
 
 	if ((ret = mdb_cursor_open(p->txn, *p->db[0], &p->cursor[0])) != MDB_SUCCESS) {
+		mdb_txn_abort(p->txn);
 		return mdb_cob_status(ret);
 	}
 
@@ -761,9 +1189,7 @@ lmdb_delete_internal (cob_file *f, const int rewrite)
 	}
 
 	if ((ret = mdb_cursor_get(p->cursor[0],&p->key,&p->data,MDB_SET)) != MDB_SUCCESS) {
-		if (f->access_mode != COB_ACCESS_SEQUENTIAL) {
-			mdb_txn_abort(p->txn);
-		}
+		mdb_txn_abort(p->txn);
 		return mdb_cob_status(ret);
 	}
 
@@ -830,6 +1256,7 @@ lmdb_delete_internal (cob_file *f, const int rewrite)
 
 	/* Delete the record */
 	if ((ret = mdb_cursor_del(p->cursor[0], 0)) != MDB_SUCCESS) {
+		mdb_txn_abort(p->txn);
 		return mdb_cob_status(ret);
 	}
 
@@ -839,14 +1266,6 @@ lmdb_delete_internal (cob_file *f, const int rewrite)
 	return COB_STATUS_00_SUCCESS;
 }
 
-static int
-mdb_resize_env (MDB_env* e)
-{
-	MDB_envinfo ei;
-	mdb_env_info (e, &ei);
-	return mdb_env_set_mapsize (e, ei.me_mapsize * 2 );
-}
-
 /* Delete file */
 static int
 lmdb_file_delete (cob_file_api *a, cob_file *f, char *filename)
@@ -873,12 +1292,22 @@ lmdb_open (cob_file_api *a, cob_file *f, char *filename, const int mode, const i
 	/* cob_chk_file_mapping manipulates file_open_name directly */
 
 	struct indexed_file	*p;
+	MDB_stat	st;
 	size_t i, j;
 	size_t maxsize;
 	char	runtime_buffer [COB_FILE_MAX+1];
 	int    ret = 0;
 	int nonexistent = 0;
 	int lock_mode;
+	int exclusive = 0;
+
+	if (f->flag_io_tran
+	 && f->flag_close_pend
+	 && f->file != NULL) {
+		/* CLOSE waited for COMMIT/ROLLBACK, the file is still open */
+		f->open_mode = mode;
+		return COB_STATUS_00_SUCCESS;
+	}
 
 	a->chk_file_mapping (f, NULL);
 
@@ -909,6 +1338,8 @@ lmdb_open (cob_file_api *a, cob_file *f, char *filename, const int mode, const i
 	}
 
 	p = cob_malloc (sizeof (struct indexed_file));
+	/* The read transaction is kept in the file, not in the thread */
+	p->env_flags = MDB_NOTLS;
 
 	switch (mode) {
 	case COB_OPEN_INPUT:
@@ -926,6 +1357,8 @@ lmdb_open (cob_file_api *a, cob_file *f, char *filename, const int mode, const i
 
 	p->db              = cob_malloc(sizeof(MDB_dbi *) * f->nkeys);
 	p->cursor          = cob_malloc(sizeof(MDB_cursor *) * f->nkeys);
+	p->rcursor         = cob_malloc(sizeof(MDB_cursor *) * f->nkeys);
+	p->rpos            = -1;
 	p->last_readkey    = cob_malloc(sizeof(unsigned char *) * 2 * f->nkeys);
 	p->last_dupno      = cob_malloc(sizeof(unsigned int * ) * 2 * f->nkeys);
 	p->rewrite_sec_key = cob_malloc(sizeof(int) * f->nkeys);
@@ -965,6 +1398,14 @@ lmdb_open (cob_file_api *a, cob_file *f, char *filename, const int mode, const i
 		}
 	}
 
+	if (mode != COB_OPEN_INPUT
+	 && (ret = lmdb_map_open (f, p)) != MDB_SUCCESS) {
+		mdb_env_close(p->db_env);
+		p->db_env = NULL;
+		indexed_file_free(p);
+		return mdb_cob_status(ret);
+	}
+
 	if (nonexistent) {
 		if (f->flag_optional) {
 			if (mode == COB_OPEN_INPUT) {
@@ -994,6 +1435,9 @@ lmdb_open (cob_file_api *a, cob_file *f, char *filename, const int mode, const i
 		indexed_file_free(p);
 		return mdb_cob_status(ret);
 	}
+	if (mdb_env_stat (p->db_env, &st) == MDB_SUCCESS) {
+		p->psize = st.ms_psize;
+	}
 
 	if (sharing) {
 		if (mode == COB_OPEN_OUTPUT 
@@ -1033,7 +1477,7 @@ lmdb_open (cob_file_api *a, cob_file *f, char *filename, const int mode, const i
 				return COB_STATUS_30_PERMANENT_ERROR;
 			}
 		}
-
+		exclusive = (lock_mode == F_WRLCK);
 	}
 
 	if ((ret = mdb_txn_begin(p->db_env, NULL, p->txn_flags, &p->txn)) != MDB_SUCCESS) {
@@ -1113,6 +1557,25 @@ lmdb_open (cob_file_api *a, cob_file *f, char *filename, const int mode, const i
 			return mdb_cob_status(ret);
 	}
 
+	/* Group commit, with COB_FILE_ROLLBACK the batch is the transaction
+	   ended by COMMIT/ROLLBACK instead of the QBL kept by fileio */
+	f->flag_io_tran = 0;
+	if (mode != COB_OPEN_INPUT) {
+		if (f->flag_do_qbl) {
+			p->tran = 1;
+			f->flag_io_tran = 1;
+			f->flag_do_qbl = 0;
+		}
+		p->group = p->tran
+			|| (exclusive
+			 && (file_setptr->cob_lmdb_commit > 1
+			  || file_setptr->cob_lmdb_commit_time > 0));
+		(void)lmdb_map_check (f);
+	}
+	lmdb_map_trace (f, "opened");
+	p->next = lmdb_files;
+	lmdb_files = p;
+
 	f->open_mode = mode;
 	if (mode == COB_OPEN_OUTPUT ) {
 		a->cob_write_dict(f, db_buff);
@@ -1133,19 +1596,90 @@ static int
 lmdb_close (cob_file_api *a, cob_file *f, const int opt)
 {
 	struct indexed_file *p = f->file;
+	struct indexed_file **l;
 	int i;
+	int ret;
 	COB_UNUSED (a);
 	COB_UNUSED(opt);
 
+	ret = lmdb_batch_end (p, 0);
+	lmdb_map_trace (f, "closed");
+	for (i = 0; i < f->nkeys; i++) {
+		if (p->rcursor[i] != NULL) {
+			mdb_cursor_close(p->rcursor[i]);
+		}
+	}
+	cob_free (p->rcursor);
+	p->rcursor = NULL;
+	if (p->rtxn != NULL) {
+		mdb_txn_abort(p->rtxn);
+	}
+	for (l = &lmdb_files; *l != NULL; l = &(*l)->next) {
+		if (*l == p) {
+			*l = p->next;
+			break;
+		}
+	}
 	for (i = 0; i < f->nkeys; i++) {
 		mdb_close(p->db_env, *p->db[i]);
 	}
 	mdb_env_close(p->db_env);
 	p->db_env = NULL;
 	if (p) cob_free(p);
+	f->file = NULL;
+	if (ret != MDB_SUCCESS) {
+		return mdb_cob_status(ret);
+	}
 	return COB_STATUS_00_SUCCESS;
 }
 
+/* COMMIT of the updates grouped in a batch */
+
+static int
+lmdb_sync (cob_file_api *a, cob_file *f)
+{
+	struct indexed_file	*p = f->file;
+	int			ret;
+
+	COB_UNUSED (a);
+	if (p == NULL
+	 || p->tran) {
+		return 0;
+	}
+	if ((ret = lmdb_batch_end (p, 0)) != MDB_SUCCESS) {
+		return mdb_cob_status(ret);
+	}
+	return 0;
+}
+
+static int
+lmdb_commit (cob_file_api *a, cob_file *f)
+{
+	struct indexed_file	*p = f->file;
+	int			ret;
+
+	COB_UNUSED (a);
+	f->flag_was_updated = 0;
+	if (p != NULL
+	 && (ret = lmdb_batch_end (p, 0)) != MDB_SUCCESS) {
+		return mdb_cob_status(ret);
+	}
+	return 0;
+}
+
+static int
+lmdb_rollback (cob_file_api *a, cob_file *f)
+{
+	struct indexed_file	*p = f->file;
+
+	COB_UNUSED (a);
+	f->flag_was_updated = 0;
+	if (p != NULL) {
+		(void)lmdb_batch_end (p, 1);
+	}
+	return 0;
+}
+
 /* START INDEXED file with positioning */
 
 static int
@@ -1226,18 +1760,8 @@ lmdb_read_next (cob_file_api *a, cob_file *f, const int read_opts)
 		nextprev = MDB_FIRST;
 	}
 
-	if ((ret = 	mdb_txn_begin(p->db_env, NULL, MDB_RDONLY, &p->txn)) != MDB_SUCCESS) {
-		return mdb_cob_status(ret);
-	}
-
 	/* The open cursor makes this function atomic */
-	if (p->key_index != 0) {
-		if ((ret = mdb_cursor_open(p->txn, *p->db[0], &p->cursor[0])) != MDB_SUCCESS) {
-			return mdb_cob_status(ret);
-		}
-	}
-
-	if ((ret = mdb_cursor_open(p->txn, *p->db[p->key_index], &p->cursor[p->key_index])) != MDB_SUCCESS) {
+	if ((ret = lmdb_read_begin (f, 0)) != MDB_SUCCESS) {
 		return mdb_cob_status(ret);
 	}
 
@@ -1245,11 +1769,7 @@ lmdb_read_next (cob_file_api *a, cob_file *f, const int read_opts)
 		/* Data is read in lmdb_open or lmdb_start */
 		if (p->data.mv_data == NULL || (f->flag_first_read == 2 &&
 				nextprev == MDB_PREV)) {
-			mdb_cursor_close(p->cursor[p->key_index]);
-			if (p->key_index != 0) {
-				mdb_cursor_close(p->cursor[0]);
-			}
-			mdb_txn_abort(p->txn);
+			lmdb_read_end (p, 0);
 			return COB_STATUS_10_END_OF_FILE;
 		}
 
@@ -1314,6 +1834,10 @@ lmdb_read_next (cob_file_api *a, cob_file *f, const int read_opts)
 	if (!f->flag_first_read || file_changed) {
 		if (nextprev == MDB_FIRST || nextprev == MDB_LAST) {
 			read_nextprev = 1;
+		} else if (!f->flag_first_read
+			&& p->rpos == (int)p->key_index) {
+			/* The cursor is still on the record read last */
+			read_nextprev = 1;
 		} else {
 			p->key.mv_size = (size_t) db_keylen(f,p->key_index);
 			p->key.mv_data = p->last_readkey[p->key_index];
@@ -1324,11 +1848,7 @@ lmdb_read_next (cob_file_api *a, cob_file *f, const int read_opts)
 					nextprev = MDB_LAST;
 					read_nextprev = 1;
 				} else {
-					mdb_cursor_close(p->cursor[p->key_index]);
-					if (p->key_index != 0) {
-						mdb_cursor_close(p->cursor[0]);
-					}
-					mdb_txn_commit(p->txn);
+					lmdb_read_end (p, 0);
 					return COB_STATUS_10_END_OF_FILE;
 				}
 			} else {
@@ -1346,11 +1866,7 @@ lmdb_read_next (cob_file_api *a, cob_file *f, const int read_opts)
 								nextprev = MDB_LAST;
 								read_nextprev = 1;
 							} else {
-								mdb_cursor_close(p->cursor[p->key_index]);
-								if (p->key_index != 0) {
-									mdb_cursor_close(p->cursor[0]);
-								}
-								mdb_txn_commit(p->txn);
+								lmdb_read_end (p, 0);
 								return COB_STATUS_10_END_OF_FILE;
 							}
 						} else {
@@ -1381,11 +1897,7 @@ lmdb_read_next (cob_file_api *a, cob_file *f, const int read_opts)
 		if (read_nextprev) {
 			ret = mdb_cursor_get(p->cursor[p->key_index],&p->key,&p->data,nextprev);
 			if (ret != 0) {
-				mdb_cursor_close(p->cursor[p->key_index]);
-				if (p->key_index != 0) {
-					mdb_cursor_close(p->cursor[0]);
-				}
-				mdb_txn_commit(p->txn);
+				lmdb_read_end (p, 0);
 				return COB_STATUS_10_END_OF_FILE;
 			}
 		}
@@ -1399,11 +1911,7 @@ lmdb_read_next (cob_file_api *a, cob_file *f, const int read_opts)
 			p->key.mv_data = p->data.mv_data;
 			p->key.mv_size = p->primekeylen;
 			if (mdb_get(p->txn,*p->db[0],&p->key,&p->data) != 0) {
-				mdb_cursor_close(p->cursor[p->key_index]);
-				if (p->key_index != 0) {
-					mdb_cursor_close(p->cursor[0]);
-				}
-				mdb_txn_commit(p->txn);
+				lmdb_read_end (p, 0);
 				return COB_STATUS_23_KEY_NOT_EXISTS;
 			}
 		}
@@ -1447,11 +1955,7 @@ lmdb_read_next (cob_file_api *a, cob_file *f, const int read_opts)
 		}
 	}
 
-	mdb_cursor_close(p->cursor[p->key_index]);
-	if (p->key_index != 0) {
-		mdb_cursor_close(p->cursor[0]);
-	}
-	mdb_txn_commit(p->txn);
+	lmdb_read_end (p, 1);
 
 	f->record->size = p->data.mv_size;
 	if (f->record->size > f->record_max) {
@@ -1489,13 +1993,23 @@ lmdb_write (cob_file_api *a, cob_file *f, const int opt)
 		return COB_STATUS_21_KEY_INVALID;
 	}
 	memcpy (p->last_key, p->key.mv_data, (size_t)p->key.mv_size);
+	lmdb_read_reset (p);
+	if ((rc = lmdb_map_check (f)) != MDB_SUCCESS
+	 || (rc = lmdb_batch_begin (p)) != MDB_SUCCESS) {
+		return mdb_cob_status(rc);
+	}
 	while ((rc = lmdb_write_internal(f, 0, opt, cs)) != MDB_SUCCESS) {
 		if (rc == MDB_MAP_FULL) {
-			mdb_resize_env(p->db_env);
+			if ((rc = lmdb_map_grow (f)) != MDB_SUCCESS) {
+				return mdb_cob_status(rc);
+			}
 		} else {
 			return mdb_cob_status(rc);
 		}
 	}
+	if ((rc = lmdb_batch_check (p, 1)) != MDB_SUCCESS) {
+		return mdb_cob_status(rc);
+	}
 	return (cs != COB_STATUS_00_SUCCESS) ? cs : COB_STATUS_00_SUCCESS;
 }
 
@@ -1504,11 +2018,24 @@ lmdb_write (cob_file_api *a, cob_file *f, const int opt)
 static int
 lmdb_delete (cob_file_api *a, cob_file *f)
 {
+	struct indexed_file	*p = f->file;
+	int			ret;
+
 	COB_UNUSED (a);
 	if (f->flag_nonexistent) {
 		return COB_STATUS_49_I_O_DENIED;
 	}
-	return lmdb_delete_internal (f, 0);
+	lmdb_read_reset (p);
+	if ((ret = lmdb_batch_begin (p)) != MDB_SUCCESS) {
+		return mdb_cob_status(ret);
+	}
+	if ((ret = lmdb_delete_internal (f, 0)) != COB_STATUS_00_SUCCESS) {
+		return ret;
+	}
+	if ((ret = lmdb_batch_check (p, 1)) != MDB_SUCCESS) {
+		return mdb_cob_status(ret);
+	}
+	return COB_STATUS_00_SUCCESS;
 }
 
 /* REWRITE record to the INDEXED file  */
@@ -1525,25 +2052,58 @@ lmdb_rewrite (cob_file_api *a, cob_file *f, const int opt)
 	if (f->flag_nonexistent) {
 		return COB_STATUS_49_I_O_DENIED;
 	}
-	/* Check duplicate alternate keys */
-	if (check_alt_keys (f, 1)) {
-		return COB_STATUS_22_KEY_EXISTS;
+	lmdb_read_reset (p);
+	if ((ret = lmdb_map_check (f)) != MDB_SUCCESS
+	 || (ret = lmdb_batch_begin (p)) != MDB_SUCCESS) {
+		return mdb_cob_status(ret);
 	}
 
-	/* Delete the current record */
-	if ((ret = lmdb_delete_internal (f, 1)) != COB_STATUS_00_SUCCESS) {
-		return ret;
+	/* Check duplicate alternate keys */
+	if (f->nkeys > 1) {
+		if ((ret = lmdb_op_begin (p, MDB_RDONLY)) != MDB_SUCCESS) {
+			return mdb_cob_status(ret);
+		}
+		ret = check_alt_keys (f, 1);
+		mdb_txn_abort(p->txn);
+		if (ret) {
+			return COB_STATUS_22_KEY_EXISTS;
+		}
 	}
 
-	/* Write data */
-	db_setkey (f, 0);
-	while ((ret = lmdb_write_internal (f, 1, opt, cs)) != MDB_SUCCESS) {
-		if (ret == MDB_MAP_FULL) {
-			mdb_resize_env(p->db_env);
-		} else {
+	/* Delete the current record and write the new one, both nested in
+	   one transaction that is abandoned if any step fails, so that the
+	   record is not lost (neither in the batch nor in the file) */
+	for (;;) {
+		if ((ret = lmdb_op_begin (p, p->txn_flags)) != MDB_SUCCESS) {
+			return mdb_cob_status(ret);
+		}
+		p->optxn = p->txn;
+		if ((ret = lmdb_delete_internal (f, 1)) != COB_STATUS_00_SUCCESS) {
+			mdb_txn_abort (p->optxn);
+			p->optxn = NULL;
+			return ret;
+		}
+		db_setkey (f, 0);
+		ret = lmdb_write_internal (f, 1, opt, cs);
+		if (ret == MDB_SUCCESS) {
+			ret = mdb_txn_commit (p->optxn);
+			p->optxn = NULL;
+			if (ret != MDB_SUCCESS) {
+				return mdb_cob_status(ret);
+			}
+			break;
+		}
+		mdb_txn_abort (p->optxn);
+		p->optxn = NULL;
+		/* Map full: grow it (without transaction) and start again */
+		if (ret != MDB_MAP_FULL
+		 || (ret = lmdb_map_grow (f)) != MDB_SUCCESS) {
 			return mdb_cob_status(ret);
 		}
 	}
+	if ((ret = lmdb_batch_check (p, 1)) != MDB_SUCCESS) {
+		return mdb_cob_status(ret);
+	}
 	return (cs != COB_STATUS_00_SUCCESS) ? cs : COB_STATUS_00_SUCCESS;
 }
 
@@ -1555,7 +2115,14 @@ lmdb_rewrite (cob_file_api *a, cob_file *f, const int opt)
 static void
 cob_lmdb_exit_fileio (cob_file_api *a)
 {
+	struct indexed_file	*p;
+
 	COB_UNUSED (a);
+	/* STOP RUN: commit what is left of the batches */
+	for (p = lmdb_files; p != NULL; p = p->next) {
+		(void)lmdb_batch_end (p, p->tran);
+	}
+	lmdb_files = NULL;
 	if(db_buff)
 		cob_free (db_buff);
 	db_buff = NULL;